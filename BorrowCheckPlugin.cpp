@@ -4,13 +4,37 @@
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Basic/Diagnostic.h"
 #include "clang/Frontend/CompilerInstance.h"
-#include "clang/AST/ParentMapContext.h" // For getParents
 #include "clang/AST/DeclCXX.h"          // For CXXRecordDecl, CXXConstructorDecl
 #include "clang/AST/ExprCXX.h"          // For CXXConstructExpr, MemberExpr
 #include "clang/AST/Decl.h"             // For VarDecl, ValueDecl
+#include "clang/AST/DeclTemplate.h"     // For ClassTemplateDecl
 #include "clang/AST/Stmt.h"             // For CompoundStmt
+#include "clang/Analysis/CFG.h"         // For the flow-sensitive engine
+#include "clang/Index/USRGeneration.h"  // For cross-TU summary keys
+#include "clang/Lex/Lexer.h"            // For Lexer::getSourceText
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <optional>
 #include <unordered_map>
+
 #include <vector>
 #include <string>
 
@@ -19,261 +43,2736 @@ using namespace clang;
 // Represents the borrow state of a variable
 struct BorrowState
 {
-  bool mutablyBorrowed = false;
+  int mutablyBorrowed = 0;
   int immutablyBorrowed = 0;
+  SourceLocation movedAt; // Where the owner was last moved from; invalid while it holds a value
+};
+
+// Diagnostics reported by the borrow checker
+enum class BorrowDiag
+{
+  PluginRunning,
+  NotTracked,
+  ImmutableWhileMutable,
+  MutableWhileImmutable,
+  MutableWhileMutable,
+  TooManyErrors,
+  UseAfterMove,
+  MoveWhileBorrowed,
+  MoveIntoWhileBorrowed,
+  BorrowOutlivesOwner,
+  NumDiags
+};
+
+// A violation found during analysis, reported once all functions are done so
+// that results from parallel workers come out in source order
+struct PendingDiag
+{
+  SourceLocation loc;
+  BorrowDiag diag;
+  const NamedDecl *decl;                  // Streamed as the quoted %0 argument
+  std::string cachedName;                 // Used for %0 instead of decl when replayed from the result cache
+  SourceLocation conflictLoc;             // Declaration of a live borrow it conflicts with, if known
+  const FunctionDecl *function = nullptr; // Function the violation is in, null at TU level
+
+  std::string name() const { return decl ? decl->getNameAsString() : cachedName; }
+};
+
+// Custom diagnostic IDs, registered once per consumer instead of on every report
+class BorrowDiagnostics
+{
+  DiagnosticsEngine &DE;
+  unsigned ids[static_cast<unsigned>(BorrowDiag::NumDiags)];
+
+  unsigned &id(BorrowDiag diag) { return ids[static_cast<unsigned>(diag)]; }
+
+public:
+  explicit BorrowDiagnostics(DiagnosticsEngine &de) : DE(de)
+  {
+    // A remark rather than a warning so -Werror builds using -add-plugin still succeed
+    id(BorrowDiag::PluginRunning) = DE.getCustomDiagID(DiagnosticsEngine::Remark,
+                                                       "BorrowCheckPlugin is running");
+    id(BorrowDiag::NotTracked) = DE.getCustomDiagID(DiagnosticsEngine::Error,
+                                                    "Variable %0 is not being tracked");
+    id(BorrowDiag::ImmutableWhileMutable) = DE.getCustomDiagID(DiagnosticsEngine::Error,
+                                                               "Cannot immutably borrow %0 while it is mutably borrowed");
+    id(BorrowDiag::MutableWhileImmutable) = DE.getCustomDiagID(DiagnosticsEngine::Error,
+                                                               "Cannot mutably borrow %0 while it is immutably borrowed");
+    id(BorrowDiag::MutableWhileMutable) = DE.getCustomDiagID(DiagnosticsEngine::Error,
+                                                             "Cannot mutably borrow %0 while it is already mutably borrowed");
+    id(BorrowDiag::TooManyErrors) = DE.getCustomDiagID(DiagnosticsEngine::Note,
+                                                       "Too many borrow errors in %0; skipping the rest of the function");
+    id(BorrowDiag::UseAfterMove) = DE.getCustomDiagID(DiagnosticsEngine::Error,
+                                                      "Use of %0 after it was moved from");
+    id(BorrowDiag::MoveWhileBorrowed) = DE.getCustomDiagID(DiagnosticsEngine::Error,
+                                                           "Cannot move out of %0 while it is borrowed");
+    id(BorrowDiag::MoveIntoWhileBorrowed) = DE.getCustomDiagID(DiagnosticsEngine::Error,
+                                                               "Cannot move into %0 while it is borrowed");
+    id(BorrowDiag::BorrowOutlivesOwner) = DE.getCustomDiagID(DiagnosticsEngine::Error,
+                                                             "Borrow of %0 is kept by something that outlives it");
+  }
+
+  DiagnosticBuilder report(BorrowDiag diag, SourceLocation loc)
+  {
+    return DE.Report(loc, id(diag));
+  }
+
+  // The diagnostic's text with %0 filled in, as clang prints it
+  std::string message(const PendingDiag &pending) const
+  {
+    llvm::StringRef format = DE.getDiagnosticIDs()->getDescription(ids[static_cast<unsigned>(pending.diag)]);
+    llvm::StringRef before, after;
+    std::tie(before, after) = format.split("%0");
+    if (before.size() == format.size())
+      return format.str();
+    return (before + "'" + pending.name() + "'" + after).str();
+  }
+
+  // Stable name of a diagnostic in machine-readable output. Borrow conflicts use
+  // the BorrowError::ErrorCode that ownership.h raises for the same conflict at
+  // runtime. Moving out of a borrowed owner is always MoveWithActiveBorrows,
+  // although ownership.h raises MoveFromWithActiveBorrows when the move is an
+  // assignment, and an escaping borrow is the DestroyWithActiveBorrows it causes.
+  static llvm::StringRef code(BorrowDiag diag)
+  {
+    switch (diag)
+    {
+    case BorrowDiag::PluginRunning:
+      return "PluginRunning";
+    case BorrowDiag::NotTracked:
+      return "NotTracked";
+    case BorrowDiag::ImmutableWhileMutable:
+      return "ImmutableBorrowOfMutablyBorrowed";
+    case BorrowDiag::MutableWhileImmutable:
+      return "MutableBorrowOfImmutablyBorrowed";
+    case BorrowDiag::MutableWhileMutable:
+      return "MutableBorrowOfMutablyBorrowed";
+    case BorrowDiag::UseAfterMove:
+      return "UseAfterMove";
+    case BorrowDiag::MoveWhileBorrowed:
+      return "MoveWithActiveBorrows";
+    case BorrowDiag::MoveIntoWhileBorrowed:
+      return "MoveIntoWithActiveBorrows";
+    case BorrowDiag::BorrowOutlivesOwner:
+      return "DestroyWithActiveBorrows";
+    case BorrowDiag::TooManyErrors:
+    case BorrowDiag::NumDiags:
+      break;
+    }
+    return "TooManyErrors";
+  }
+
+  static llvm::StringRef severity(BorrowDiag diag)
+  {
+    if (diag == BorrowDiag::PluginRunning)
+      return "remark";
+    return diag == BorrowDiag::TooManyErrors ? "note" : "error";
+  }
+
+  void report(const PendingDiag &pending)
+  {
+    DiagnosticBuilder builder = report(pending.diag, pending.loc);
+    if (pending.decl)
+      builder << pending.decl;
+    else
+      builder << ("'" + pending.cachedName + "'");
+  }
+};
+
+using BorrowStateMap = llvm::DenseMap<const ValueDecl *, BorrowState>;
+
+// Counters printed by -stats. Every analysis context keeps its own and the
+// consumer merges them, so parallel workers never share one.
+struct BorrowCheckStats
+{
+  unsigned functions = 0;        // Function bodies analyzed
+  unsigned cachedFunctions = 0;  // Function verdicts replayed from the result cache
+  unsigned reusedFunctions = 0;  // Function verdicts replayed from the -incremental cache
+  unsigned instantiations = 0;   // Template instantiations checked because their pattern could not be
+  unsigned cfgFunctions = 0;     // Function bodies analyzed by the CFG engine
+  unsigned cfgBlocks = 0;        // Blocks in the CFGs built for them
+  unsigned varDecls = 0;         // VisitVarDecl hits
+  unsigned callExprs = 0;        // VisitCallExpr hits
+  unsigned trackedVariables = 0; // Owners added with addTrackedVariable
+  unsigned borrows = 0;          // Borrow calls checked
+  unsigned peakScopeDepth = 0;
+  unsigned peakLiveBorrows = 0;
+  unsigned peakStateEntries = 0; // Largest borrow state map
+  double globalSeconds = 0;      // Traversing TU-level declarations
+  double functionSeconds = 0;    // Analyzing function bodies, wall clock
+
+  void merge(const BorrowCheckStats &other)
+  {
+    functions += other.functions;
+    cachedFunctions += other.cachedFunctions;
+    reusedFunctions += other.reusedFunctions;
+    instantiations += other.instantiations;
+    cfgFunctions += other.cfgFunctions;
+    cfgBlocks += other.cfgBlocks;
+    varDecls += other.varDecls;
+    callExprs += other.callExprs;
+    trackedVariables += other.trackedVariables;
+    borrows += other.borrows;
+    peakScopeDepth = std::max(peakScopeDepth, other.peakScopeDepth);
+    peakLiveBorrows = std::max(peakLiveBorrows, other.peakLiveBorrows);
+    peakStateEntries = std::max(peakStateEntries, other.peakStateEntries);
+  }
 };
 
 // Manages the borrow state and scope for variables
 class BorrowContext
 {
-  std::unordered_map<std::string, BorrowState> currentBorrowStates;
-  std::vector<std::unordered_map<std::string, BorrowState>> scopeStack;
-  ASTContext &astContext;
-  DiagnosticsEngine &DE;
+  // A borrow kept by a borrower, such as a variable or a container it was
+  // stored in; it ends when the scope at depth closes
+  struct LiveBorrow
+  {
+    const ValueDecl *borrower;
+    const ValueDecl *owner;
+    unsigned depth;
+    bool isMutable;
+  };
+
+  // An owner declared inside a scope; its state is dropped when the scope closes
+  struct ScopedOwner
+  {
+    const ValueDecl *owner;
+    unsigned depth;
+  };
+
+  // When a variable is destroyed relative to others: the depth of its scope,
+  // then the order of declaration within it. A variable with a smaller
+  // Lifetime outlives one with a larger Lifetime.
+  using Lifetime = std::pair<unsigned, unsigned>;
+
+  BorrowStateMap currentBorrowStates;
+  const BorrowStateMap *globalStates;     // Read-only TU-level state shared by per-function contexts
+  std::vector<LiveBorrow> liveBorrows;    // Borrows held by variables, innermost scope last
+  std::vector<ScopedOwner> scopedOwners;  // Owners declared in open scopes, innermost scope last
+  unsigned depth = 0;                     // Number of open scopes
+  llvm::DenseMap<const ValueDecl *, Lifetime> localLifetimes; // Locals declared with declareLocal
+  llvm::DenseMap<const ValueDecl *, Lifetime> ownerLifetimes; // Owners in scopedOwners
+  unsigned declarations = 0;              // Numbers locals and owners in declaration order
+  std::vector<PendingDiag> pendingDiags; // Violations found so far, in traversal order
+  unsigned maxDiagsPerFunction;                 // 0 means no limit
+  const FunctionDecl *currentFunction = nullptr; // Function whose body is being traversed
+  unsigned functionDiagCount = 0;               // Errors reported in currentFunction
+  BorrowCheckStats statistics;
+
+  // Records an error unless the current function has already hit the limit
+  void reportError(BorrowDiag diag, SourceLocation loc, const NamedDecl *var,
+                   SourceLocation conflictLoc = SourceLocation())
+  {
+    if (diagLimitReached())
+      return;
+    pendingDiags.push_back({loc, diag, var, {}, conflictLoc, currentFunction});
+    if (currentFunction && ++functionDiagCount == maxDiagsPerFunction)
+      pendingDiags.push_back({loc, BorrowDiag::TooManyErrors, currentFunction, {}, {}, currentFunction});
+  }
+
+  // Where the newest live borrow of owner of the given kind was declared; only
+  // looked up once a conflict is being reported
+  SourceLocation conflictingBorrow(const ValueDecl *owner, bool isMutable) const
+  {
+    for (auto it = liveBorrows.rbegin(); it != liveBorrows.rend(); ++it)
+    {
+      if (it->owner == owner && it->isMutable == isMutable)
+        return it->borrower->getLocation();
+    }
+    return SourceLocation();
+  }
+
+  // Where a live borrow of owner of either kind was declared, mutable ones first
+  SourceLocation conflictingBorrow(const ValueDecl *owner) const
+  {
+    SourceLocation loc = conflictingBorrow(owner, true);
+    return loc.isValid() ? loc : conflictingBorrow(owner, false);
+  }
+
+  // Returns the state for var, or null if neither this context nor the globals have one
+  const BorrowState *stateForRead(const ValueDecl *var) const
+  {
+    auto it = currentBorrowStates.find(var);
+    if (it != currentBorrowStates.end())
+      return &it->second;
+    if (!globalStates)
+      return nullptr;
+    auto global = globalStates->find(var);
+    return global != globalStates->end() ? &global->second : nullptr;
+  }
+
+  // Returns the state for var. Globals are copied in from the shared snapshot on first write.
+  BorrowState &stateForWrite(const ValueDecl *var)
+  {
+    auto it = currentBorrowStates.find(var);
+    if (it == currentBorrowStates.end())
+    {
+      BorrowState initial;
+      if (globalStates)
+      {
+        auto global = globalStates->find(var);
+        if (global != globalStates->end())
+          initial = global->second;
+      }
+      it = currentBorrowStates.try_emplace(var, initial).first;
+      statistics.peakStateEntries = std::max<unsigned>(statistics.peakStateEntries, currentBorrowStates.size());
+    }
+    return it->second;
+  }
+
+  // The lifetime of a borrower. A variable declared before the current
+  // statement may be in an enclosing scope; otherwise it is being declared
+  // now. Globals, static locals and fields outlive every scope of the function.
+  Lifetime borrowerLifetime(const ValueDecl *borrower) const
+  {
+    auto it = localLifetimes.find(borrower);
+    if (it != localLifetimes.end())
+      return it->second;
+    const auto *var = dyn_cast<VarDecl>(borrower);
+    if (var && !var->hasGlobalStorage())
+      return {depth, declarations + 1};
+    return {0, 0};
+  }
+
+  // The lifetime of an owner; globals and reference parameters outlive every local
+  Lifetime ownerLifetime(const ValueDecl *owner) const
+  {
+    auto it = ownerLifetimes.find(owner);
+    return it != ownerLifetimes.end() ? it->second : Lifetime(0, 0);
+  }
+
+  // Reports a borrower that is destroyed after its owner
+  void checkOutlives(const ValueDecl *owner, const ValueDecl *borrower, SourceLocation loc)
+  {
+    if (borrowerLifetime(borrower) < ownerLifetime(owner))
+      reportError(BorrowDiag::BorrowOutlivesOwner, loc, owner, borrower->getLocation());
+  }
+
+  // Keeps a borrow alive until its borrower's scope closes. liveBorrows stays
+  // sorted by depth, so a borrower in an enclosing scope goes below the
+  // borrows of inner scopes.
+  void keepBorrow(const ValueDecl *borrower, const ValueDecl *owner, bool isMutable)
+  {
+    unsigned at = borrowerLifetime(borrower).first;
+    auto pos = std::upper_bound(liveBorrows.begin(), liveBorrows.end(), at,
+                                [](unsigned d, const LiveBorrow &borrow)
+                                { return d < borrow.depth; });
+    liveBorrows.insert(pos, {borrower, owner, at, isMutable});
+    statistics.peakLiveBorrows = std::max<unsigned>(statistics.peakLiveBorrows, liveBorrows.size());
+  }
+
+  // Gives back a borrow whose borrower went out of scope
+  void retire(const LiveBorrow &borrow)
+  {
+    auto it = currentBorrowStates.find(borrow.owner);
+    if (it == currentBorrowStates.end())
+      return;
+    if (borrow.isMutable)
+      it->second.mutablyBorrowed--;
+    else
+      it->second.immutablyBorrowed--;
+  }
 
 public:
-  explicit BorrowContext(ASTContext &ctx)
-      : astContext(ctx), DE(ctx.getDiagnostics()) {}
+  explicit BorrowContext(unsigned maxDiags, const BorrowStateMap *globals = nullptr)
+      : globalStates(globals), maxDiagsPerFunction(maxDiags) {}
 
-  // Generates a unique key for a variable declaration based on its source location
-  static std::string getKeyForDecl(const ValueDecl *decl, ASTContext &ctx)
+  // Returns the key borrow state is stored under; redeclarations share the canonical decl
+  static const ValueDecl *getKeyForDecl(const ValueDecl *decl)
   {
     if (!decl)
-      return "<unknown_decl_key>";
-    return decl->getLocation().printToString(ctx.getSourceManager());
+      return nullptr;
+    return cast<ValueDecl>(decl->getCanonicalDecl());
   }
 
   void enterScope()
   {
-    scopeStack.push_back(currentBorrowStates);
+    depth++;
+    statistics.peakScopeDepth = std::max(statistics.peakScopeDepth, depth);
   }
 
+  // Ends the borrows held by the scope's variables and forgets the owners it declared
   void exitScope()
   {
-    if (!scopeStack.empty())
+    if (depth == 0)
+      return;
+    while (!liveBorrows.empty() && liveBorrows.back().depth >= depth)
     {
-      currentBorrowStates = scopeStack.back();
-      scopeStack.pop_back();
+      retire(liveBorrows.back());
+      liveBorrows.pop_back();
     }
+    while (!scopedOwners.empty() && scopedOwners.back().depth >= depth)
+    {
+      currentBorrowStates.erase(scopedOwners.back().owner);
+      ownerLifetimes.erase(scopedOwners.back().owner);
+      scopedOwners.pop_back();
+    }
+    depth--;
+  }
+
+  // Starts counting errors for a function body; returns the enclosing function
+  const FunctionDecl *beginFunction(const FunctionDecl *func)
+  {
+    const FunctionDecl *enclosing = currentFunction;
+    currentFunction = func;
+    functionDiagCount = 0;
+    return enclosing;
+  }
+
+  void endFunction(const FunctionDecl *enclosing)
+  {
+    currentFunction = enclosing;
+    functionDiagCount = 0;
+  }
+
+  // True once the current function has reported maxDiagsPerFunction errors
+  bool diagLimitReached() const
+  {
+    return currentFunction && maxDiagsPerFunction != 0 &&
+           functionDiagCount >= maxDiagsPerFunction;
   }
 
   // Adds a new variable to be tracked
-  void addTrackedVariable(const std::string &varKey)
+  void addTrackedVariable(const ValueDecl *varKey)
+  {
+    stateForWrite(varKey) = BorrowState();
+    statistics.trackedVariables++;
+    if (depth > 0)
+    {
+      scopedOwners.push_back({varKey, depth});
+      ownerLifetimes[varKey] = {depth, ++declarations};
+    }
+  }
+
+  // Records a parameter that owns its Unique. It lives in the scope of the
+  // function body, which opens next, and outlives every local declared there.
+  void addOwnerParameter(const ValueDecl *param)
   {
-    currentBorrowStates[varKey] = BorrowState();
+    scopedOwners.push_back({param, depth + 1});
+    ownerLifetimes[param] = {depth + 1, 0};
   }
 
-  // Records an immutable borrow and checks for violations
-  void recordImmutableBorrow(const std::string &varKey, const std::string &varName, SourceLocation reportLoc)
+  // Records an immutable borrow and checks for violations. A borrow bound to a
+  // borrower variable lasts until its scope closes; a temporary one ends with
+  // its full-expression, so it is checked but not kept.
+  void recordImmutableBorrow(const ValueDecl *varKey, SourceLocation reportLoc,
+                             const ValueDecl *borrower = nullptr)
   {
-    BorrowState *state = &currentBorrowStates[varKey]; // Assumes varKey exists from addTrackedVariable
+    BorrowState *state = &stateForWrite(varKey); // Assumes varKey exists from addTrackedVariable
+    statistics.borrows++;
 
     // If state is not found, it means the variable is not being tracked
     if (state == nullptr)
     {
-      unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Error,
-                                       "Variable '%0' is not being tracked");
-      DE.Report(reportLoc, ID) << varName;
+      reportError(BorrowDiag::NotTracked, reportLoc, varKey);
       return;
     }
 
-    state->immutablyBorrowed++;
-    if (state->mutablyBorrowed)
+    if (state->mutablyBorrowed > 0)
     {
-      unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Error,
-                                       "Cannot immutably borrow '%0' while it is mutably borrowed");
-      DE.Report(reportLoc, ID) << varName;
+      reportError(BorrowDiag::ImmutableWhileMutable, reportLoc, varKey, conflictingBorrow(varKey, true));
+    }
+    if (borrower)
+    {
+      checkOutlives(varKey, borrower, reportLoc);
+      state->immutablyBorrowed++;
+      keepBorrow(borrower, varKey, false);
     }
   }
 
   // Records a mutable borrow and checks for violations
-  void recordMutableBorrow(const std::string &varKey, const std::string &varName, SourceLocation reportLoc)
+  void recordMutableBorrow(const ValueDecl *varKey, SourceLocation reportLoc,
+                           const ValueDecl *borrower = nullptr)
   {
-    BorrowState *state = &currentBorrowStates[varKey]; // Similar assumption as above
+    BorrowState *state = &stateForWrite(varKey); // Similar assumption as above
+    statistics.borrows++;
 
     // If state is not found, it means the variable is not being tracked
     if (state == nullptr)
     {
-      unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Error,
-                                       "Variable '%0' is not being tracked");
-      DE.Report(reportLoc, ID) << varName;
+      reportError(BorrowDiag::NotTracked, reportLoc, varKey);
       return;
     }
 
-    state->mutablyBorrowed = true;
     if (state->immutablyBorrowed > 0)
     {
-      unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Error,
-                                       "Cannot mutably borrow '%0' while it is immutably borrowed");
-      DE.Report(reportLoc, ID) << varName;
+      reportError(BorrowDiag::MutableWhileImmutable, reportLoc, varKey, conflictingBorrow(varKey, false));
+    }
+    else if (state->mutablyBorrowed > 0)
+    {
+      reportError(BorrowDiag::MutableWhileMutable, reportLoc, varKey, conflictingBorrow(varKey, true));
+    }
+    if (borrower)
+    {
+      checkOutlives(varKey, borrower, reportLoc);
+      state->mutablyBorrowed++;
+      keepBorrow(borrower, varKey, true);
     }
   }
 
-  void clear()
+  // Records the scope a local is declared in, so borrows later stored in it
+  // last as long as it does
+  void declareLocal(const ValueDecl *var)
   {
-    currentBorrowStates.clear();
-    scopeStack.clear();
+    localLifetimes[var] = {depth, ++declarations};
   }
-};
-
-namespace
-{
 
-  class BorrowCheckerVisitor : public RecursiveASTVisitor<BorrowCheckerVisitor>
+  // The owner whose borrow borrower holds, or null if it holds none
+  const ValueDecl *ownerOf(const ValueDecl *borrower) const
   {
-    ASTContext &Context;
-    BorrowContext &borrowContext;
-
-  public:
-    explicit BorrowCheckerVisitor(ASTContext &ctx, BorrowContext &bc)
-        : Context(ctx), borrowContext(bc) {}
-
-    bool VisitCXXConstructExpr(CXXConstructExpr *expr)
+    for (auto it = liveBorrows.rbegin(); it != liveBorrows.rend(); ++it)
     {
-      if (!expr)
-        return true;
-      const CXXConstructorDecl *ctor = expr->getConstructor();
-      if (!ctor)
-        return true;
-      const CXXRecordDecl *record = ctor->getParent();
-      if (!record)
-        return true;
+      if (it->borrower == borrower)
+        return it->owner;
+    }
+    return nullptr;
+  }
 
-      std::string className = record->getNameAsString();
+  // Number of live borrows borrower holds
+  unsigned heldBorrows(const ValueDecl *borrower) const
+  {
+    return std::count_if(liveBorrows.begin(), liveBorrows.end(),
+                         [borrower](const LiveBorrow &borrow)
+                         { return borrow.borrower == borrower; });
+  }
 
-      if (className == "Unique")
+  // Ends the oldest count borrows borrower holds, as when it is assigned a new
+  // value. A borrower's borrows share a depth, so the oldest come first.
+  void releaseBorrows(const ValueDecl *borrower, unsigned count)
+  {
+    for (auto it = liveBorrows.begin(); it != liveBorrows.end() && count > 0;)
+    {
+      if (it->borrower != borrower)
       {
-        const VarDecl *initializedVarDecl = nullptr;
-        // Try to find the VarDecl this constructor is initializing
-        auto parents = Context.getParents(*expr);
-        for (const auto &parent : parents)
-        {
-          if (const auto *vd = parent.get<VarDecl>())
-          {
-            initializedVarDecl = vd;
-            break;
-          }
-          // Handle cases like Unique u = Unique()
-          if (const auto *ile = parent.get<InitListExpr>())
-          {
-            auto ileParents = Context.getParents(*ile);
-            for (const auto &ileParent : ileParents)
-            {
-              if (const auto *vd_ile = ileParent.get<VarDecl>())
-              {
-                initializedVarDecl = vd_ile;
-                break;
-              }
-            }
-            if (initializedVarDecl)
-              break;
-          }
-        }
-
-        if (initializedVarDecl)
-        {
-          std::string varKey = BorrowContext::getKeyForDecl(initializedVarDecl, Context);
-          borrowContext.addTrackedVariable(varKey);
-        }
+        ++it;
+        continue;
       }
-      return true;
+      retire(*it);
+      it = liveBorrows.erase(it);
+      count--;
     }
+  }
 
-    bool VisitCallExpr(CallExpr *expr)
+  // Records that holder keeps a copy of the borrow that borrower holds, as in
+  // v.push_back(b). Copies never conflict with the borrow they were made from.
+  void recordBorrowCopy(const ValueDecl *borrower, const ValueDecl *holder, SourceLocation loc)
+  {
+    for (auto it = liveBorrows.rbegin(); it != liveBorrows.rend(); ++it)
     {
-      if (!expr)
-        return true;
-      Expr *callee = expr->getCallee();
-      if (!callee)
-        return true;
+      if (it->borrower != borrower)
+        continue;
+      const ValueDecl *owner = it->owner;
+      bool isMutable = it->isMutable;
+      checkOutlives(owner, holder, loc);
+      BorrowState &state = stateForWrite(owner);
+      if (isMutable)
+        state.mutablyBorrowed++;
+      else
+        state.immutablyBorrowed++;
+      keepBorrow(holder, owner, isMutable);
+      return;
+    }
+  }
 
-      auto *memberCall = dyn_cast<MemberExpr>(callee->IgnoreParenCasts());
-      if (!memberCall)
-        return true;
+  // Reports a borrow of a local owner returned from its function
+  void recordReturnedBorrow(const ValueDecl *owner, SourceLocation loc)
+  {
+    if (ownerLifetime(owner).first > 0)
+      reportError(BorrowDiag::BorrowOutlivesOwner, loc, owner);
+  }
 
-      auto *methodDecl = dyn_cast<CXXMethodDecl>(memberCall->getMemberDecl());
-      if (!methodDecl)
-        return true;
+  // Records that owner was moved from. Its borrows would dangle, so moving a
+  // borrowed owner is an error, as it is at run time.
+  void recordMove(const ValueDecl *owner, SourceLocation loc)
+  {
+    BorrowState &state = stateForWrite(owner);
+    if (state.mutablyBorrowed > 0 || state.immutablyBorrowed > 0)
+      reportError(BorrowDiag::MoveWhileBorrowed, loc, owner, conflictingBorrow(owner));
+    state.movedAt = loc;
+  }
 
-      std::string methodName = methodDecl->getNameAsString();
-      if (methodName != "borrow" && methodName != "borrow_mut")
-        return true;
+  // Records that a value was moved into owner, so it may be used again
+  void recordMoveInto(const ValueDecl *owner, SourceLocation loc)
+  {
+    BorrowState &state = stateForWrite(owner);
+    if (state.mutablyBorrowed > 0 || state.immutablyBorrowed > 0)
+      reportError(BorrowDiag::MoveIntoWhileBorrowed, loc, owner, conflictingBorrow(owner));
+    state.movedAt = SourceLocation();
+  }
 
-      Expr *base = memberCall->getBase()->IgnoreParenCasts();
-      auto *declRef = dyn_cast<DeclRefExpr>(base);
-      if (!declRef)
-        return true;
+  // Checks a use of var against the moves recorded so far
+  void checkUse(const ValueDecl *var, SourceLocation loc)
+  {
+    const BorrowState *state = stateForRead(var);
+    if (state && state->movedAt.isValid())
+      reportError(BorrowDiag::UseAfterMove, loc, var, state->movedAt);
+  }
 
-      const ValueDecl *varValueDecl = declRef->getDecl();
-      if (!varValueDecl)
-        return true;
+  // State of every variable tracked at this level, used as another context's globals
+  const BorrowStateMap &states() const { return currentBorrowStates; }
 
-      std::string varName = varValueDecl->getNameAsString();
-      std::string varKey = BorrowContext::getKeyForDecl(varValueDecl, Context);
-      SourceLocation reportLoc = expr->getExprLoc();
+  // Hands over the violations recorded so far
+  std::vector<PendingDiag> takeDiagnostics() { return std::move(pendingDiags); }
 
-      if (methodName == "borrow")
-      {
-        borrowContext.recordImmutableBorrow(varKey, varName, reportLoc);
-      }
-      else // borrow_mut
+  BorrowCheckStats &stats() { return statistics; }
+
+  void clear()
+  {
+    currentBorrowStates.clear();
+    liveBorrows.clear();
+    scopedOwners.clear();
+    localLifetimes.clear();
+    ownerLifetimes.clear();
+    declarations = 0;
+    depth = 0;
+    pendingDiags.clear();
+    statistics = BorrowCheckStats();
+    currentFunction = nullptr;
+    functionDiagCount = 0;
+  }
+};
+
+// Options parsed from -plugin-arg-borrow-check arguments
+struct BorrowCheckOptions
+{
+  bool skipSystemHeaders = true;         // Disabled by -analyze-system-headers
+  bool restrictToAllowedPaths = false;   // Enabled by -main-file-only or any -allow-path=
+  std::vector<std::string> allowedPaths; // Path prefixes analyzed alongside the main file
+  unsigned maxDiagsPerFunction = 0;      // Set by -max-diags-per-function=N, 0 means no limit
+  unsigned jobs = 1;                     // Set by -jobs=N, 0 means one per hardware thread
+  std::string cacheDir;                  // Set by -cache-dir=<path>, empty disables the result cache
+  bool flowSensitive = false;            // Set by -engine=cfg, -engine=lexical is the fast default
+  bool printStats = false;               // Set by -stats
+  bool emitSummary = false;              // Set by -emit-summary
+  std::string summaryOut;                // Set by -summary-out=<path>, or derived from the output file
+  std::vector<std::string> summaryPaths; // Set by -summaries=<path>, files or directories to load
+  std::string diagJsonPath;              // Set by -diag-jsonl=<path|fd:N|->, empty disables JSON output
+  bool escapeAnalysis = false;           // Set by -escape-analysis
+  bool incremental = false;              // Set by -incremental
+};
+
+// Kind of borrow a method call takes on its Unique object
+enum class BorrowKind
+{
+  None,
+  Immutable,
+  Mutable
+};
+
+// The Unique template and its borrow methods (borrow/borrow_mut and their
+// try_ variants), looked up once per TU so that
+// classifying a construction or call is a pointer comparison
+class OwnershipDecls
+{
+  const ClassTemplateDecl *uniqueTemplate = nullptr;
+  llvm::SmallPtrSet<const ClassTemplateDecl *, 2> borrowTemplates; // Borrowed and BorrowedMut
+  llvm::DenseMap<const FunctionDecl *, BorrowKind> borrowMethods;
+  llvm::DenseMap<const IdentifierInfo *, BorrowKind> borrowNames; // For calls in templates, not yet resolved to a method
+  llvm::SmallPtrSet<const FunctionTemplateDecl *, 4> ownerFactories;
+
+  static const ClassTemplateDecl *findClassTemplate(ASTContext &ctx, const char *name)
+  {
+    for (const NamedDecl *found : ctx.getTranslationUnitDecl()->lookup(&ctx.Idents.get(name)))
+    {
+      if (const auto *ctd = dyn_cast<ClassTemplateDecl>(found))
+        return ctd->getCanonicalDecl();
+    }
+    return nullptr;
+  }
+
+  // Records the ownership.h factory templates that return a new Unique
+  void addOwnerFactories(ASTContext &ctx)
+  {
+    static const char *const names[] = {"make_unique_in", "map_file", "map_file_mut"};
+    for (const char *name : names)
+    {
+      for (const NamedDecl *found : ctx.getTranslationUnitDecl()->lookup(&ctx.Idents.get(name)))
       {
-        borrowContext.recordMutableBorrow(varKey, varName, reportLoc);
+        if (const auto *ftd = dyn_cast<FunctionTemplateDecl>(found))
+          ownerFactories.insert(ftd->getCanonicalDecl());
       }
-      return true;
     }
+  }
 
-    bool VisitDeclRefExpr(DeclRefExpr *expr)
+  // Records the borrow methods declared by a Unique pattern definition. Element
+  // and slice borrows of Unique<T[]> count against the whole owner. A split or
+  // field projection is one mutable borrow whose parts never conflict with each
+  // other, only with later borrows of the owner. Member templates such as
+  // borrow_fields_mut are not among methods(), so they are found in decls().
+  void addBorrowMethods(const CXXRecordDecl *pattern)
+  {
+    if (!pattern)
+      return;
+    for (const Decl *member : pattern->decls())
     {
-      // Currently unused, but can be extended for use-after-free checks
-      return true;
+      const auto *method = dyn_cast<CXXMethodDecl>(member);
+      if (const auto *ftd = dyn_cast<FunctionTemplateDecl>(member))
+        method = dyn_cast<CXXMethodDecl>(ftd->getTemplatedDecl());
+      if (!method)
+        continue;
+      auto kind = borrowNames.find(method->getIdentifier());
+      if (kind != borrowNames.end())
+        borrowMethods[method->getCanonicalDecl()] = kind->second;
     }
+  }
 
-    bool TraverseCompoundStmt(CompoundStmt *stmt)
+  void addBorrowNames(ASTContext &ctx)
+  {
+    static const std::pair<const char *, BorrowKind> names[] = {
+        {"borrow", BorrowKind::Immutable},
+        {"try_borrow", BorrowKind::Immutable},
+        {"borrow_at", BorrowKind::Immutable},
+        {"borrow_slice", BorrowKind::Immutable},
+        {"borrow_mut", BorrowKind::Mutable},
+        {"try_borrow_mut", BorrowKind::Mutable},
+        {"borrow_mut_at", BorrowKind::Mutable},
+        {"borrow_mut_slice", BorrowKind::Mutable},
+        {"split_at_mut", BorrowKind::Mutable},
+        {"borrow_fields_mut", BorrowKind::Mutable},
+    };
+    for (const auto &entry : names)
+      borrowNames[&ctx.Idents.get(entry.first)] = entry.second;
+  }
+
+  // The borrow method a call in a template names, as in u.borrow() with u of
+  // a dependent type, and the expression it is called on
+  BorrowKind dependentBorrowCall(const CallExpr *call, const Expr *&base) const
+  {
+    const auto *member = dyn_cast_or_null<CXXDependentScopeMemberExpr>(call->getCallee());
+    if (!member || member->isImplicitAccess())
+      return BorrowKind::None;
+    auto kind = borrowNames.find(member->getMember().getAsIdentifierInfo());
+    if (kind == borrowNames.end())
+      return BorrowKind::None;
+    base = member->getBase()->IgnoreParenImpCasts();
+    return kind->second;
+  }
+
+public:
+  // Finds ::Unique and the methods of its primary and partial specializations
+  // (such as Unique<T[]>); returns false if the TU does not declare it
+  bool lookup(ASTContext &ctx)
+  {
+    borrowTemplates.clear();
+    borrowMethods.clear();
+    borrowNames.clear();
+    ownerFactories.clear();
+    uniqueTemplate = findClassTemplate(ctx, "Unique");
+    if (!uniqueTemplate)
+      return false;
+    for (const char *name : {"Borrowed", "BorrowedMut"})
     {
-      borrowContext.enterScope();
-      RecursiveASTVisitor::TraverseCompoundStmt(stmt);
-      borrowContext.exitScope();
-      return true;
+      if (const ClassTemplateDecl *borrowTemplate = findClassTemplate(ctx, name))
+        borrowTemplates.insert(borrowTemplate);
     }
-  };
+    addBorrowNames(ctx);
+    addBorrowMethods(uniqueTemplate->getTemplatedDecl()->getDefinition());
+    llvm::SmallVector<ClassTemplatePartialSpecializationDecl *, 2> partials;
+    uniqueTemplate->getPartialSpecializations(partials);
+    for (const ClassTemplatePartialSpecializationDecl *partial : partials)
+      addBorrowMethods(partial->getDefinition());
+    addOwnerFactories(ctx);
+    return true;
+  }
 
-  class BorrowCheckConsumer : public ASTConsumer
+  // True if call is a factory such as make_unique_in that creates an owner
+  bool isOwnerFactoryCall(const CallExpr *call) const
   {
-    BorrowContext borrowContext;
-    ASTContext &astContext;
+    const FunctionDecl *callee = call ? call->getDirectCallee() : nullptr;
+    const FunctionTemplateDecl *primary = callee ? callee->getPrimaryTemplate() : nullptr;
+    return primary && ownerFactories.count(primary->getCanonicalDecl());
+  }
 
-  public:
-    explicit BorrowCheckConsumer(ASTContext &Context)
-        : borrowContext(Context), astContext(Context)
+  // True if record is a specialization of ::Unique
+  bool isUniqueRecord(const CXXRecordDecl *record) const
+  {
+    const auto *spec = dyn_cast_or_null<ClassTemplateSpecializationDecl>(record);
+    return spec && uniqueTemplate &&
+           spec->getSpecializedTemplate()->getCanonicalDecl() == uniqueTemplate;
+  }
+
+  // True if type is a Unique specialization or, in a template, names one with
+  // dependent arguments such as Unique<T>
+  bool isUniqueType(QualType type) const
+  {
+    if (isUniqueRecord(type->getAsCXXRecordDecl()))
+      return true;
+    const auto *spec = type->getAs<TemplateSpecializationType>();
+    const TemplateDecl *specialized = spec ? spec->getTemplateName().getAsTemplateDecl() : nullptr;
+    return specialized && uniqueTemplate && specialized->getCanonicalDecl() == uniqueTemplate;
+  }
+
+  // True if record is a specialization of ::Borrowed or ::BorrowedMut
+  bool isBorrowRecord(const CXXRecordDecl *record) const
+  {
+    const auto *spec = dyn_cast_or_null<ClassTemplateSpecializationDecl>(record);
+    return spec && borrowTemplates.count(spec->getSpecializedTemplate()->getCanonicalDecl());
+  }
+
+  // Maps a method of a Unique specialization back to its pattern to classify it.
+  // A member template specialization such as borrow_fields_mut<int, int> maps
+  // through its template to the one declared in the pattern.
+  BorrowKind classifyMethod(const CXXMethodDecl *method) const
+  {
+    const FunctionDecl *pattern = method->getInstantiatedFromMemberFunction();
+    if (const FunctionTemplateDecl *primary = method->getPrimaryTemplate())
     {
-      DiagnosticsEngine &DE = Context.getDiagnostics();
-      unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Warning,
-                                       "BorrowCheckPlugin is running");
-      DE.Report(ID);
+      while (const FunctionTemplateDecl *from = primary->getInstantiatedFromMemberTemplate())
+        primary = from;
+      pattern = primary->getTemplatedDecl();
     }
+    if (!pattern)
+      pattern = method;
+    auto it = borrowMethods.find(pattern->getCanonicalDecl());
+    return it == borrowMethods.end() ? BorrowKind::None : it->second;
+  }
 
-    void HandleTranslationUnit(ASTContext &Context) override
+  // Classifies a call as a borrow of a named Unique variable; owner is set to
+  // the borrowed variable's key
+  BorrowKind classifyBorrowCall(const CallExpr *call, const ValueDecl *&owner) const
+  {
+    const Expr *callee = call->getCallee();
+    if (!callee)
+      return BorrowKind::None;
+
+    const auto *memberCall = dyn_cast<MemberExpr>(callee->IgnoreParenCasts());
+    if (!memberCall)
     {
-      borrowContext.clear(); // Clear the context
-      BorrowCheckerVisitor visitor(astContext, borrowContext);
-      visitor.TraverseDecl(Context.getTranslationUnitDecl());
+      // In a template, a borrow of a Unique<T> variable is not resolved yet
+      const Expr *base = nullptr;
+      BorrowKind kind = dependentBorrowCall(call, base);
+      const auto *declRef = dyn_cast_or_null<DeclRefExpr>(base);
+      if (kind == BorrowKind::None || !declRef || !isUniqueType(declRef->getType()))
+        return BorrowKind::None;
+      owner = BorrowContext::getKeyForDecl(declRef->getDecl());
+      return kind;
     }
-  };
 
-  class BorrowCheckAction : public PluginASTAction
+    const auto *methodDecl = dyn_cast<CXXMethodDecl>(memberCall->getMemberDecl());
+    if (!methodDecl)
+      return BorrowKind::None;
+
+    BorrowKind kind = classifyMethod(methodDecl);
+    if (kind == BorrowKind::None)
+      return BorrowKind::None;
+
+    const auto *declRef = dyn_cast<DeclRefExpr>(memberCall->getBase()->IgnoreParenCasts());
+    if (!declRef || !declRef->getDecl())
+      return BorrowKind::None;
+
+    owner = BorrowContext::getKeyForDecl(declRef->getDecl());
+    return kind;
+  }
+
+  // Returns the call a variable initializer evaluates, looking through
+  // cleanups, temporaries, elidable copies and, in templates, parentheses
+  static const CallExpr *initializerCall(const Expr *init)
   {
-  protected:
-    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
-                                                   llvm::StringRef) override
+    while (init)
     {
-      return std::make_unique<BorrowCheckConsumer>(CI.getASTContext());
+      init = init->IgnoreImplicit();
+      if (const auto *parens = dyn_cast<ParenListExpr>(init))
+      {
+        if (parens->getNumExprs() != 1)
+          break;
+        init = parens->getExpr(0)->IgnoreImplicit();
+      }
+      const auto *construct = dyn_cast<CXXConstructExpr>(init);
+      if (!construct || !construct->isElidable() || construct->getNumArgs() != 1)
+        break;
+      init = construct->getArg(0);
     }
+    return dyn_cast_or_null<CallExpr>(init);
+  }
 
-    bool ParseArgs(const CompilerInstance &CI,
-                   const std::vector<std::string> &args) override
+  // The borrow expr evaluates to, looking through copies, moves and
+  // temporaries: a borrow call, a DeclRefExpr naming a variable that may hold
+  // one, or null
+  const Expr *borrowValue(const Expr *expr) const
+  {
+    while (expr)
     {
-      return true;
+      expr = expr->IgnoreImplicit()->IgnoreParens();
+      if (const auto *construct = dyn_cast<CXXConstructExpr>(expr))
+      {
+        const CXXConstructorDecl *ctor = construct->getConstructor();
+        if (!ctor || construct->getNumArgs() != 1 || !isBorrowRecord(ctor->getParent()))
+          return nullptr;
+        expr = construct->getArg(0);
+      }
+      else if (const auto *call = dyn_cast<CallExpr>(expr))
+      {
+        if (call->isCallToStdMove() && call->getNumArgs() == 1)
+        {
+          expr = call->getArg(0);
+          continue;
+        }
+        const ValueDecl *owner = nullptr;
+        return classifyBorrowCall(call, owner) != BorrowKind::None ? call : nullptr;
+      }
+      else
+      {
+        const auto *ref = dyn_cast<DeclRefExpr>(expr);
+        return ref && isBorrowRecord(ref->getType()->getAsCXXRecordDecl()) ? ref : nullptr;
+      }
+    }
+    return nullptr;
+  }
+
+  // The borrower variable that b = a.borrow() or b = std::move(c) gives a new
+  // value, or null if stmt is not such an assignment
+  const DeclRefExpr *reassignedBorrower(const Stmt *stmt) const
+  {
+    const auto *op = dyn_cast<CXXOperatorCallExpr>(stmt);
+    if (!op || op->getOperator() != OO_Equal || op->getNumArgs() != 2)
+      return nullptr;
+    const auto *ref = dyn_cast<DeclRefExpr>(op->getArg(0)->IgnoreParenImpCasts());
+    return ref && isBorrowRecord(ref->getType()->getAsCXXRecordDecl()) ? ref : nullptr;
+  }
+
+  // The variable or field whose storage an lvalue such as v, v[i], s.items or
+  // this->items refers to; null if it is not known, e.g. for a call result
+  static const ValueDecl *storageRoot(const Expr *expr)
+  {
+    while (expr)
+    {
+      expr = expr->IgnoreParenImpCasts();
+      if (const auto *member = dyn_cast<MemberExpr>(expr))
+      {
+        if (isa<CXXThisExpr>(member->getBase()->IgnoreParenImpCasts()))
+          return member->getMemberDecl();
+        expr = member->getBase();
+      }
+      else if (const auto *subscript = dyn_cast<ArraySubscriptExpr>(expr))
+        expr = subscript->getBase();
+      else if (const auto *op = dyn_cast<CXXOperatorCallExpr>(expr))
+        expr = op->getOperator() == OO_Subscript ? op->getArg(0) : nullptr;
+      else if (const auto *ref = dyn_cast<DeclRefExpr>(expr))
+        return isa<VarDecl>(ref->getDecl()) ? BorrowContext::getKeyForDecl(ref->getDecl()) : nullptr;
+      else
+        return nullptr;
+    }
+    return nullptr;
+  }
+
+  // True if call may be a borrow or move of a Unique once its template is
+  // instantiated, but cannot be classified in the pattern: t.borrow() on a
+  // variable of type T, or std::move of a Unique<T>, whose constructor is not
+  // resolved yet
+  bool dependsOnInstantiation(const CallExpr *call) const
+  {
+    const Expr *base = nullptr;
+    if (dependentBorrowCall(call, base) != BorrowKind::None)
+    {
+      const auto *declRef = dyn_cast<DeclRefExpr>(base);
+      return !declRef || !isUniqueType(declRef->getType());
+    }
+    const auto *lookup = dyn_cast_or_null<UnresolvedLookupExpr>(call->getCallee()->IgnoreParenImpCasts());
+    const IdentifierInfo *name = lookup ? lookup->getName().getAsIdentifierInfo() : nullptr;
+    if (!name || !name->isStr("move") || call->getNumArgs() != 1)
+      return false;
+    const auto *arg = dyn_cast<DeclRefExpr>(call->getArg(0)->IgnoreParenImpCasts());
+    return arg && isUniqueType(arg->getType());
+  }
+
+  // A transfer of ownership out of a named Unique: Unique b(std::move(a)),
+  // passing std::move(a) by value, or b = std::move(a)
+  struct Move
+  {
+    const DeclRefExpr *source = nullptr; // a, which is left moved-from
+    const DeclRefExpr *target = nullptr; // b in a move assignment, which holds a value again
+  };
+
+  // The Unique variable named by std::move(x), if expr is such a call
+  const DeclRefExpr *movedVariable(const Expr *expr) const
+  {
+    const auto *call = dyn_cast<CallExpr>(expr->IgnoreParenImpCasts());
+    if (!call || !call->isCallToStdMove() || call->getNumArgs() != 1)
+      return nullptr;
+    const auto *ref = dyn_cast<DeclRefExpr>(call->getArg(0)->IgnoreParenImpCasts());
+    if (!ref || !isUniqueRecord(ref->getType()->getAsCXXRecordDecl()))
+      return nullptr;
+    return ref;
+  }
+
+  // Classifies stmt as a Unique move constructor or move assignment; returns
+  // false if it neither moves from nor into a named variable
+  bool classifyMove(const Stmt *stmt, Move &move) const
+  {
+    move = Move();
+    if (const auto *construct = dyn_cast<CXXConstructExpr>(stmt))
+    {
+      const CXXConstructorDecl *ctor = construct->getConstructor();
+      if (ctor && ctor->isMoveConstructor() && isUniqueRecord(ctor->getParent()))
+        move.source = movedVariable(construct->getArg(0));
+    }
+    else if (const auto *op = dyn_cast<CXXOperatorCallExpr>(stmt))
+    {
+      const auto *method = dyn_cast_or_null<CXXMethodDecl>(op->getDirectCallee());
+      if (op->getOperator() == OO_Equal && op->getNumArgs() == 2 && method &&
+          method->isMoveAssignmentOperator() && isUniqueRecord(method->getParent()))
+      {
+        move.target = dyn_cast<DeclRefExpr>(op->getArg(0)->IgnoreParenImpCasts());
+        move.source = movedVariable(op->getArg(1));
+        // a = std::move(a) leaves a as it was
+        if (move.target && move.source && move.target->getDecl() == move.source->getDecl())
+          move = Move();
+      }
+    }
+    return move.source || move.target;
+  }
+};
+
+namespace
+{
+
+  // What a function does with one of its parameters, as recorded in ownership
+  // summaries. Only Unique parameters have effects.
+  enum ParamEffect : uint8_t
+  {
+    ParamBorrowsImmutably = 1 << 0, // Calls borrow() or a similar method on a Unique parameter
+    ParamBorrowsMutably = 1 << 1,   // Calls borrow_mut() or a similar method on it
+    ParamMoves = 1 << 2,            // Takes the Unique by value or moves from it
+  };
+
+  // Identifies a function across TUs by a hash of its USR
+  std::optional<uint64_t> summaryKeyFor(const FunctionDecl *func)
+  {
+    llvm::SmallString<128> usr;
+    if (index::generateUSRForDecl(func->getCanonicalDecl(), usr))
+      return std::nullopt;
+    return llvm::xxHash64(usr);
+  }
+
+  // Ownership summaries of the functions in other TUs, read from side files.
+  // Files are mapped on the first lookup and searched in place, so loading
+  // costs one map per file whether or not its summaries are used.
+  //
+  // File layout, all integers little-endian:
+  //   "BCSUMMRY", uint32 version, uint32 record count
+  //   records sorted by key: uint64 key, uint32 effects offset, uint32 parameter count
+  //   effect bytes, one per parameter, at the offsets the records give
+  class SummaryIndex
+  {
+    static constexpr llvm::StringLiteral Magic = "BCSUMMRY";
+    static constexpr uint32_t Version = 1;
+    static constexpr size_t HeaderSize = 16;
+    static constexpr size_t RecordSize = 16;
+
+    std::vector<std::string> paths; // Summary files or directories of .bcsum files
+    mutable std::once_flag loaded;
+    mutable std::vector<std::unique_ptr<llvm::MemoryBuffer>> files;
+
+    static bool isValid(llvm::StringRef data)
+    {
+      if (data.size() < HeaderSize || data.take_front(Magic.size()) != Magic ||
+          llvm::support::endian::read32le(data.data() + 8) != Version)
+        return false;
+      uint64_t count = llvm::support::endian::read32le(data.data() + 12);
+      return data.size() >= HeaderSize + count * RecordSize;
+    }
+
+    void addFile(llvm::StringRef path) const
+    {
+      auto buffer = llvm::MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+      if (buffer && isValid((*buffer)->getBuffer()))
+        files.push_back(std::move(*buffer));
+    }
+
+    void load() const
+    {
+      for (const std::string &path : paths)
+      {
+        if (!llvm::sys::fs::is_directory(path))
+        {
+          addFile(path);
+          continue;
+        }
+        std::error_code ec;
+        for (llvm::sys::fs::directory_iterator it(path, ec), end; it != end && !ec; it.increment(ec))
+        {
+          if (llvm::sys::path::extension(it->path()) == ".bcsum")
+            addFile(it->path());
+        }
+      }
+    }
+
+    // Binary search of one file's sorted records
+    static bool find(llvm::StringRef data, uint64_t key, llvm::ArrayRef<uint8_t> &effects)
+    {
+      const char *records = data.data() + HeaderSize;
+      size_t low = 0, high = llvm::support::endian::read32le(data.data() + 12);
+      while (low < high)
+      {
+        size_t mid = low + (high - low) / 2;
+        const char *record = records + mid * RecordSize;
+        uint64_t recordKey = llvm::support::endian::read64le(record);
+        if (recordKey < key)
+        {
+          low = mid + 1;
+          continue;
+        }
+        if (recordKey > key)
+        {
+          high = mid;
+          continue;
+        }
+        uint32_t offset = llvm::support::endian::read32le(record + 8);
+        uint32_t count = llvm::support::endian::read32le(record + 12);
+        if (uint64_t(offset) + count > data.size())
+          return false;
+        effects = llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(data.data() + offset), count);
+        return true;
+      }
+      return false;
+    }
+
+  public:
+    void addPath(std::string path) { paths.push_back(std::move(path)); }
+    bool enabled() const { return !paths.empty(); }
+
+    // Finds the parameter effects summarized for key; safe to call from several threads
+    bool lookup(uint64_t key, llvm::ArrayRef<uint8_t> &effects) const
+    {
+      std::call_once(loaded, [this]
+                     { load(); });
+      for (const auto &file : files)
+      {
+        if (find(file->getBuffer(), key, effects))
+          return true;
+      }
+      return false;
+    }
+
+    // Changes whenever a summary file is added, removed or rewritten, for result
+    // cache keys. Stats every summary file, but maps none of them.
+    uint64_t fingerprint() const
+    {
+      std::string data;
+      llvm::raw_string_ostream os(data);
+      auto addStatus = [&os](llvm::StringRef path)
+      {
+        llvm::sys::fs::file_status status;
+        if (!llvm::sys::fs::status(path, status))
+          os << path << ' ' << status.getSize() << ' '
+             << status.getLastModificationTime().time_since_epoch().count() << '\n';
+      };
+      for (const std::string &path : paths)
+      {
+        if (!llvm::sys::fs::is_directory(path))
+        {
+          addStatus(path);
+          continue;
+        }
+        std::vector<std::string> entries;
+        std::error_code ec;
+        for (llvm::sys::fs::directory_iterator it(path, ec), end; it != end && !ec; it.increment(ec))
+          entries.push_back(it->path());
+        std::sort(entries.begin(), entries.end());
+        for (const std::string &entry : entries)
+          addStatus(entry);
+      }
+      return llvm::xxHash64(os.str());
+    }
+
+    // Writes summaries, given as key and effects pairs, to path in the format above
+    static bool write(llvm::StringRef path, std::vector<std::pair<uint64_t, std::vector<uint8_t>>> summaries)
+    {
+      std::sort(summaries.begin(), summaries.end(),
+                [](const auto &a, const auto &b)
+                { return a.first < b.first; });
+      summaries.erase(std::unique(summaries.begin(), summaries.end(),
+                                  [](const auto &a, const auto &b)
+                                  { return a.first == b.first; }),
+                      summaries.end());
+
+      int fd;
+      llvm::SmallString<128> tempPath;
+      if (llvm::sys::fs::createUniqueFile(path + ".tmp-%%%%%%", fd, tempPath))
+        return false;
+      bool written;
+      {
+        llvm::raw_fd_ostream out(fd, /*shouldClose=*/true);
+        llvm::support::endian::Writer writer(out, llvm::support::little);
+        out << Magic;
+        writer.write<uint32_t>(Version);
+        writer.write<uint32_t>(summaries.size());
+        uint32_t offset = HeaderSize + summaries.size() * RecordSize;
+        for (const auto &summary : summaries)
+        {
+          writer.write<uint64_t>(summary.first);
+          writer.write<uint32_t>(offset);
+          writer.write<uint32_t>(summary.second.size());
+          offset += summary.second.size();
+        }
+        for (const auto &summary : summaries)
+          out.write(reinterpret_cast<const char *>(summary.second.data()), summary.second.size());
+        // Close before the rename so a short write or failed close is seen, and
+        // clear the error so the stream does not abort on destruction
+        out.close();
+        written = !out.has_error();
+        out.clear_error();
+      }
+      if (!written || llvm::sys::fs::rename(tempPath, path))
+      {
+        llvm::sys::fs::remove(tempPath);
+        return false;
+      }
+      return true;
+    }
+  };
+
+  // Computes the ParamEffect of each parameter of a function from its body
+  class ParamEffectVisitor : public RecursiveASTVisitor<ParamEffectVisitor>
+  {
+    const OwnershipDecls &ownership;
+    llvm::DenseMap<const ValueDecl *, unsigned> paramIndex;
+    std::vector<uint8_t> effects;
+
+    // The parameter an expression names, looking through std::move
+    const ValueDecl *namedParam(const Expr *expr) const
+    {
+      expr = expr->IgnoreParenImpCasts();
+      if (const auto *call = dyn_cast<CallExpr>(expr))
+      {
+        if (call->isCallToStdMove() && call->getNumArgs() == 1)
+          expr = call->getArg(0)->IgnoreParenImpCasts();
+      }
+      const auto *ref = dyn_cast<DeclRefExpr>(expr);
+      if (!ref)
+        return nullptr;
+      const ValueDecl *decl = BorrowContext::getKeyForDecl(ref->getDecl());
+      return paramIndex.count(decl) ? decl : nullptr;
+    }
+
+    void addEffect(const ValueDecl *param, uint8_t effect)
+    {
+      if (param)
+        effects[paramIndex.lookup(param)] |= effect;
+    }
+
+  public:
+    explicit ParamEffectVisitor(const OwnershipDecls &od) : ownership(od) {}
+
+    // Returns one ParamEffect mask per parameter; empty if no parameter is a
+    // Unique, in which case there is nothing to summarize
+    std::vector<uint8_t> run(FunctionDecl *func)
+    {
+      paramIndex.clear();
+      effects.assign(func->getNumParams(), 0);
+      bool hasUniqueParam = false;
+      for (unsigned i = 0; i < func->getNumParams(); ++i)
+      {
+        const ParmVarDecl *param = func->getParamDecl(i);
+        QualType type = param->getType();
+        if (!ownership.isUniqueRecord(type.getNonReferenceType()->getAsCXXRecordDecl()))
+          continue;
+        hasUniqueParam = true;
+        paramIndex[BorrowContext::getKeyForDecl(param)] = i;
+        if (!type->isLValueReferenceType())
+          effects[i] |= ParamMoves;
+      }
+      if (!hasUniqueParam)
+        return {};
+      TraverseStmt(func->getBody());
+      return effects;
+    }
+
+    bool VisitCallExpr(CallExpr *call)
+    {
+      const ValueDecl *owner = nullptr;
+      BorrowKind kind = ownership.classifyBorrowCall(call, owner);
+      if (kind != BorrowKind::None)
+        addEffect(paramIndex.count(owner) ? owner : nullptr,
+                  kind == BorrowKind::Mutable ? ParamBorrowsMutably : ParamBorrowsImmutably);
+      return true;
+    }
+
+    bool VisitCXXConstructExpr(CXXConstructExpr *construct)
+    {
+      const CXXConstructorDecl *ctor = construct->getConstructor();
+      if (!ctor || construct->getNumArgs() != 1)
+        return true;
+      if (ownership.isUniqueRecord(ctor->getParent()))
+        addEffect(namedParam(construct->getArg(0)), ParamMoves);
+      return true;
+    }
+  };
+
+  class BorrowCheckerVisitor : public RecursiveASTVisitor<BorrowCheckerVisitor>
+  {
+    BorrowContext &borrowContext;
+    const OwnershipDecls &ownership;
+    std::vector<FunctionDecl *> *deferredFunctions = nullptr;
+    llvm::SmallDenseMap<const CallExpr *, const ValueDecl *, 4> heldCalls; // Borrow calls visited next, and who keeps their result
+    const SummaryIndex *summaries = nullptr;
+    bool escapeAnalysis = false;
+    unsigned lambdaDepth = 0; // Lambda bodies being traversed, whose returns stay in the function
+    bool instantiationDependent = false; // Saw a call in a template that only its instantiations can classify
+    llvm::SmallPtrSet<const DeclRefExpr *, 4> moveOperands; // Named by a move visited just before; not uses
+
+    // Applies a move from or into a named owner
+    void recordMove(const Stmt *stmt)
+    {
+      OwnershipDecls::Move move;
+      if (!ownership.classifyMove(stmt, move))
+        return;
+      if (move.target)
+      {
+        borrowContext.recordMoveInto(BorrowContext::getKeyForDecl(move.target->getDecl()), move.target->getExprLoc());
+        moveOperands.insert(move.target);
+      }
+      if (move.source)
+      {
+        borrowContext.recordMove(BorrowContext::getKeyForDecl(move.source->getDecl()), move.source->getExprLoc());
+        moveOperands.insert(move.source);
+      }
+    }
+
+    // Checks a call to a function defined in another TU against its summary.
+    // A callee that borrows an owner argument borrows it for the duration of
+    // the call, and one that moves from it leaves it moved-from.
+    void checkSummarizedCall(const CallExpr *call)
+    {
+      const FunctionDecl *callee = call->getDirectCallee();
+      if (!summaries || !callee || callee->hasBody() || isa<CXXOperatorCallExpr>(call))
+        return;
+
+      // Only a Unique variable passed by reference, as a or std::move(a), can
+      // conflict with a live borrow. One passed by value is moved into the
+      // parameter by its move constructor, which recordMove already handles.
+      llvm::SmallVector<std::pair<unsigned, const DeclRefExpr *>, 4> owners;
+      for (unsigned i = 0; i < call->getNumArgs(); ++i)
+      {
+        const Expr *arg = call->getArg(i)->IgnoreParenImpCasts();
+        const DeclRefExpr *ref = ownership.movedVariable(arg);
+        if (!ref)
+          ref = dyn_cast<DeclRefExpr>(arg);
+        if (ref && ownership.isUniqueRecord(ref->getType()->getAsCXXRecordDecl()))
+          owners.push_back({i, ref});
+      }
+      if (owners.empty())
+        return;
+
+      std::optional<uint64_t> key = summaryKeyFor(callee);
+      llvm::ArrayRef<uint8_t> effects;
+      if (!key || !summaries->lookup(*key, effects))
+        return;
+      for (const auto &owner : owners)
+      {
+        uint8_t effect = owner.first < effects.size() ? effects[owner.first] : 0;
+        const ValueDecl *var = BorrowContext::getKeyForDecl(owner.second->getDecl());
+        SourceLocation loc = call->getArg(owner.first)->getExprLoc();
+        if (effect & ParamMoves)
+        {
+          borrowContext.recordMove(var, loc);
+          moveOperands.insert(owner.second);
+        }
+        else if (effect & ParamBorrowsMutably)
+          borrowContext.recordMutableBorrow(var, loc);
+        else if (effect & ParamBorrowsImmutably)
+          borrowContext.recordImmutableBorrow(var, loc);
+      }
+    }
+
+    // Records that holder keeps the borrow value evaluates to, if any
+    void holdBorrow(const ValueDecl *holder, const Expr *value)
+    {
+      const Expr *borrow = ownership.borrowValue(value);
+      if (const auto *call = dyn_cast_or_null<CallExpr>(borrow))
+        heldCalls[call] = holder;
+      else if (const auto *ref = dyn_cast_or_null<DeclRefExpr>(borrow))
+        borrowContext.recordBorrowCopy(BorrowContext::getKeyForDecl(ref->getDecl()), holder, ref->getExprLoc());
+    }
+
+    // A Unique taken by value in a function with a body, destroyed when it returns
+    bool isOwnerParameter(const VarDecl *decl) const
+    {
+      const auto *func = dyn_cast<FunctionDecl>(decl->getDeclContext());
+      return isa<ParmVarDecl>(decl) && func && func->doesThisDeclarationHaveABody() &&
+             !decl->getType()->isReferenceType() && ownership.isUniqueType(decl->getType());
+    }
+
+    // Container methods that keep their arguments
+    static bool isStoringMethod(const CXXMethodDecl *method)
+    {
+      static const llvm::StringLiteral names[] = {
+          "push_back", "emplace_back", "push_front", "emplace_front", "push", "emplace",
+          "insert", "emplace_hint", "insert_or_assign", "try_emplace", "assign"};
+      if (!method->getIdentifier())
+        return false;
+      llvm::StringRef name = method->getName();
+      return std::find(std::begin(names), std::end(names), name) != std::end(names);
+    }
+
+  public:
+    BorrowCheckerVisitor(BorrowContext &bc, const OwnershipDecls &od)
+        : borrowContext(bc), ownership(od) {}
+
+    // Collects function bodies into functions instead of traversing them, so
+    // they can be analyzed separately against the TU-level state
+    void deferFunctionsTo(std::vector<FunctionDecl *> *functions)
+    {
+      deferredFunctions = functions;
+    }
+
+    // Summaries of functions from other TUs to check calls against
+    void useSummaries(const SummaryIndex *index)
+    {
+      summaries = index;
+    }
+
+    // Follows borrows stored into containers, fields, globals and return values
+    void checkEscapes()
+    {
+      escapeAnalysis = true;
+    }
+
+    // True if the template traversed has calls whose borrows depend on its
+    // arguments, so its instantiations have to be checked one by one
+    bool needsInstantiations() const
+    {
+      return instantiationDependent;
+    }
+
+    // Tracks variables initialized by a Unique constructor, and remembers which
+    // borrow call initializes a borrower. Working from the VarDecl down to its
+    // initializer avoids building the TU parent map.
+    bool VisitVarDecl(VarDecl *decl)
+    {
+      if (!decl)
+        return true;
+      borrowContext.stats().varDecls++;
+      if (escapeAnalysis && !decl->hasGlobalStorage())
+        borrowContext.declareLocal(BorrowContext::getKeyForDecl(decl));
+      if (isOwnerParameter(decl))
+        borrowContext.addOwnerParameter(BorrowContext::getKeyForDecl(decl));
+      const Expr *init = decl->getInit();
+      if (!init)
+        return true;
+
+      // The initializer is traversed right after its VarDecl
+      if (const CallExpr *call = OwnershipDecls::initializerCall(init))
+      {
+        const ValueDecl *owner = nullptr;
+        if (ownership.classifyBorrowCall(call, owner) != BorrowKind::None)
+        {
+          heldCalls[call] = decl;
+          return true;
+        }
+      }
+      // Borrows passed to a constructor or initializer list, as in
+      // std::vector<Borrowed<int>> v{a.borrow()}, live as long as decl
+      if (escapeAnalysis)
+      {
+        const Expr *value = init->IgnoreImplicit();
+        if (const auto *construct = dyn_cast<CXXConstructExpr>(value))
+        {
+          for (const Expr *arg : construct->arguments())
+            holdBorrow(decl, arg);
+        }
+        else if (const auto *list = dyn_cast<InitListExpr>(value))
+        {
+          for (const Expr *element : list->inits())
+            holdBorrow(decl, element);
+        }
+      }
+
+      init = init->IgnoreImplicit();
+      // Handle cases like Unique u{...} that keep an InitListExpr around the constructor
+      if (const auto *ile = dyn_cast<InitListExpr>(init))
+      {
+        if (ile->getNumInits() != 1)
+          return true;
+        init = ile->getInit(0)->IgnoreImplicit();
+      }
+
+      // Owners come from a Unique constructor or, when the copy is elided, from a
+      // factory like make_unique_in. In a template, Unique<T> u(...) is not
+      // resolved to a constructor yet.
+      bool createsOwner = false;
+      if (decl->getType()->isDependentType())
+      {
+        createsOwner = !decl->getType()->isReferenceType() && ownership.isUniqueType(decl->getType());
+      }
+      else if (const auto *expr = dyn_cast<CXXConstructExpr>(init))
+      {
+        const CXXConstructorDecl *ctor = expr->getConstructor();
+        createsOwner = ctor && ownership.isUniqueRecord(ctor->getParent());
+      }
+      else
+      {
+        createsOwner = ownership.isOwnerFactoryCall(OwnershipDecls::initializerCall(init));
+      }
+      if (createsOwner)
+      {
+        const ValueDecl *varKey = BorrowContext::getKeyForDecl(decl);
+        borrowContext.addTrackedVariable(varKey);
+      }
+      return true;
+    }
+
+    bool VisitCallExpr(CallExpr *expr)
+    {
+      if (!expr)
+        return true;
+      borrowContext.stats().callExprs++;
+
+      const ValueDecl *varKey = nullptr;
+      BorrowKind kind = ownership.classifyBorrowCall(expr, varKey);
+      if (kind == BorrowKind::None)
+      {
+        if (expr->isTypeDependent() && ownership.dependsOnInstantiation(expr))
+          instantiationDependent = true;
+        checkSummarizedCall(expr);
+        return true;
+      }
+
+      const ValueDecl *borrower = nullptr;
+      auto held = heldCalls.find(expr);
+      if (held != heldCalls.end())
+      {
+        borrower = held->second;
+        heldCalls.erase(held);
+      }
+      SourceLocation reportLoc = expr->getExprLoc();
+      if (kind == BorrowKind::Immutable)
+      {
+        borrowContext.recordImmutableBorrow(varKey, reportLoc, borrower);
+      }
+      else // borrow_mut
+      {
+        borrowContext.recordMutableBorrow(varKey, reportLoc, borrower);
+      }
+      return true;
+    }
+
+    bool VisitCXXConstructExpr(CXXConstructExpr *expr)
+    {
+      recordMove(expr);
+      return true;
+    }
+
+    bool VisitCXXOperatorCallExpr(CXXOperatorCallExpr *expr)
+    {
+      recordMove(expr);
+      // b = a.borrow() or v[i] = a.borrow(): the assigned-to storage keeps the borrow
+      if (escapeAnalysis && expr->getOperator() == OO_Equal && expr->getNumArgs() == 2)
+      {
+        if (const ValueDecl *holder = OwnershipDecls::storageRoot(expr->getArg(0)))
+          holdBorrow(holder, expr->getArg(1));
+      }
+      return true;
+    }
+
+    // v.push_back(a.borrow()): the container keeps the borrow
+    bool VisitCXXMemberCallExpr(CXXMemberCallExpr *expr)
+    {
+      if (!escapeAnalysis || !expr->getMethodDecl() || !isStoringMethod(expr->getMethodDecl()))
+        return true;
+      const ValueDecl *holder = OwnershipDecls::storageRoot(expr->getImplicitObjectArgument());
+      if (!holder)
+        return true;
+      for (const Expr *arg : expr->arguments())
+        holdBorrow(holder, arg);
+      return true;
+    }
+
+    // A returned borrow outlives every owner local to the function
+    bool VisitReturnStmt(ReturnStmt *stmt)
+    {
+      if (!escapeAnalysis || lambdaDepth > 0 || !stmt->getRetValue())
+        return true;
+      const Expr *borrow = ownership.borrowValue(stmt->getRetValue());
+      const ValueDecl *owner = nullptr;
+      if (const auto *call = dyn_cast_or_null<CallExpr>(borrow))
+        ownership.classifyBorrowCall(call, owner);
+      else if (const auto *ref = dyn_cast_or_null<DeclRefExpr>(borrow))
+        owner = borrowContext.ownerOf(BorrowContext::getKeyForDecl(ref->getDecl()));
+      if (owner)
+        borrowContext.recordReturnedBorrow(owner, stmt->getRetValue()->getExprLoc());
+      return true;
+    }
+
+    // A borrower assigned a new value gives up the borrows it held, but only
+    // after the new value is taken, as at run time
+    bool TraverseCXXOperatorCallExpr(CXXOperatorCallExpr *expr)
+    {
+      const DeclRefExpr *reassigned = ownership.reassignedBorrower(expr);
+      const ValueDecl *borrower = reassigned ? BorrowContext::getKeyForDecl(reassigned->getDecl()) : nullptr;
+      unsigned held = borrower ? borrowContext.heldBorrows(borrower) : 0;
+      RecursiveASTVisitor::TraverseCXXOperatorCallExpr(expr);
+      if (held)
+        borrowContext.releaseBorrows(borrower, held);
+      return true;
+    }
+
+    bool TraverseLambdaExpr(LambdaExpr *expr)
+    {
+      lambdaDepth++;
+      RecursiveASTVisitor::TraverseLambdaExpr(expr);
+      lambdaDepth--;
+      return true;
+    }
+
+    // Flags uses, including borrows, of moved-from owners
+    bool VisitDeclRefExpr(DeclRefExpr *expr)
+    {
+      if (moveOperands.erase(expr))
+        return true;
+      borrowContext.checkUse(BorrowContext::getKeyForDecl(expr->getDecl()), expr->getLocation());
+      return true;
+    }
+
+    // Counts errors per function body so the limit can cut analysis short
+    bool TraverseDecl(Decl *decl)
+    {
+      auto *func = dyn_cast_or_null<FunctionDecl>(decl);
+      if (!func || !func->doesThisDeclarationHaveABody())
+        return RecursiveASTVisitor::TraverseDecl(decl);
+      if (deferredFunctions)
+      {
+        deferredFunctions->push_back(func);
+        return true;
+      }
+
+      const FunctionDecl *enclosing = borrowContext.beginFunction(func);
+      RecursiveASTVisitor::TraverseDecl(decl);
+      borrowContext.endFunction(enclosing);
+      return true;
+    }
+
+    // Stops descending into a function once it has reported too many errors
+    bool TraverseStmt(Stmt *stmt, DataRecursionQueue *queue = nullptr)
+    {
+      if (borrowContext.diagLimitReached())
+        return true;
+      return RecursiveASTVisitor::TraverseStmt(stmt, queue);
+    }
+
+    bool TraverseCompoundStmt(CompoundStmt *stmt)
+    {
+      borrowContext.enterScope();
+      RecursiveASTVisitor::TraverseCompoundStmt(stmt);
+      borrowContext.exitScope();
+      return true;
+    }
+  };
+
+  // Flow-sensitive engine: a forward dataflow over the function's CFG whose
+  // state is the set of borrower variables that may be live. A borrow ends at
+  // its borrower's automatic destructor, which the CFG places on every path
+  // out of the scope, so branches, loops and early returns are exact. The bits
+  // after the borrowers hold the owners that may have been moved from.
+  class CFGBorrowAnalysis
+  {
+    // A variable holding a borrow, e.g. b in Borrowed<int> b = data.borrow()
+    struct Borrower
+    {
+      const VarDecl *var;
+      const ValueDecl *owner;
+      BorrowKind kind;
+    };
+
+    // Borrower bits per owner, split by kind, so conflict checks are a mask test
+    struct OwnerMasks
+    {
+      llvm::BitVector immutable;
+      llvm::BitVector mutableBorrows;
+    };
+
+    ASTContext &Context;
+    const OwnershipDecls &ownership;
+    const BorrowStateMap &globals;
+    unsigned maxDiags;
+    llvm::DenseMap<const VarDecl *, unsigned> borrowerIndex;
+    std::vector<Borrower> borrowers;
+    llvm::DenseMap<const ValueDecl *, OwnerMasks> ownerMasks;
+    llvm::DenseMap<const ValueDecl *, unsigned> movedIndex; // Owners moved from or into, bits after the borrowers
+    std::vector<SourceLocation> moveSites;                  // Where each of them is moved from, for diagnostics
+    llvm::SmallPtrSet<const DeclRefExpr *, 8> moveOperands; // Owners named by a move, which are not uses
+    std::vector<PendingDiag> diags;
+    const FunctionDecl *function = nullptr;
+    unsigned numBlocks = 0;
+    unsigned checkedBorrows = 0; // Borrow calls checked in the reporting pass
+
+    // The borrow a declaration binds to a new borrower variable, if any
+    BorrowKind boundBorrow(const VarDecl *var, const ValueDecl *&owner) const
+    {
+      const CallExpr *call = OwnershipDecls::initializerCall(var->getInit());
+      if (!call)
+        return BorrowKind::None;
+      return ownership.classifyBorrowCall(call, owner);
+    }
+
+    // Assigns a dense index to every borrower declared in the CFG
+    void indexBorrowers(const CFG &cfg)
+    {
+      for (const CFGBlock *block : cfg)
+      {
+        for (const CFGElement &element : *block)
+        {
+          auto stmt = element.getAs<CFGStmt>();
+          if (stmt)
+            indexMove(stmt->getStmt());
+          const auto *declStmt = stmt ? dyn_cast<DeclStmt>(stmt->getStmt()) : nullptr;
+          if (!declStmt)
+            continue;
+          for (const Decl *decl : declStmt->decls())
+          {
+            const auto *var = dyn_cast<VarDecl>(decl);
+            const ValueDecl *owner = nullptr;
+            BorrowKind kind = var ? boundBorrow(var, owner) : BorrowKind::None;
+            if (kind == BorrowKind::None || borrowerIndex.count(var))
+              continue;
+            borrowerIndex[var] = borrowers.size();
+            borrowers.push_back({var, owner, kind});
+          }
+        }
+      }
+
+      for (unsigned index = 0; index < borrowers.size(); ++index)
+      {
+        OwnerMasks &masks = ownerMasks[borrowers[index].owner];
+        masks.immutable.resize(borrowers.size());
+        masks.mutableBorrows.resize(borrowers.size());
+        if (borrowers[index].kind == BorrowKind::Immutable)
+          masks.immutable.set(index);
+        else
+          masks.mutableBorrows.set(index);
+      }
+      for (auto &owner : movedIndex)
+        owner.second += borrowers.size();
+    }
+
+    // Gives the owners a move names a bit in the state
+    void indexMove(const Stmt *stmt)
+    {
+      OwnershipDecls::Move move;
+      if (!ownership.classifyMove(stmt, move))
+        return;
+      for (const DeclRefExpr *ref : {move.target, move.source})
+      {
+        if (!ref)
+          continue;
+        moveOperands.insert(ref);
+        const ValueDecl *owner = BorrowContext::getKeyForDecl(ref->getDecl());
+        if (movedIndex.try_emplace(owner, moveSites.size()).second)
+        {
+          auto global = globals.find(owner);
+          moveSites.push_back(global != globals.end() ? global->second.movedAt : SourceLocation());
+        }
+        if (ref == move.source)
+          moveSites[movedIndex[owner]] = ref->getExprLoc();
+      }
+    }
+
+    unsigned stateSize() const { return borrowers.size() + moveSites.size(); }
+
+    // True if owner may be borrowed in live, by a borrower of this function or
+    // by a global; conflictLoc is set to the borrower's declaration if it is known
+    bool isBorrowed(const ValueDecl *owner, const llvm::BitVector &live, SourceLocation &conflictLoc) const
+    {
+      auto masks = ownerMasks.find(owner);
+      if (masks != ownerMasks.end())
+      {
+        conflictLoc = conflictingBorrow(live, masks->second.mutableBorrows);
+        if (conflictLoc.isInvalid())
+          conflictLoc = conflictingBorrow(live, masks->second.immutable);
+        if (conflictLoc.isValid())
+          return true;
+      }
+      auto global = globals.find(owner);
+      return global != globals.end() &&
+             (global->second.mutablyBorrowed > 0 || global->second.immutablyBorrowed > 0);
+    }
+
+    // Moves out of and into owners, checking they are not borrowed at the time
+    void applyMove(const Stmt *stmt, llvm::BitVector &live, bool reportConflicts)
+    {
+      OwnershipDecls::Move move;
+      if (!ownership.classifyMove(stmt, move))
+        return;
+      SourceLocation conflictLoc;
+      if (move.target)
+      {
+        const ValueDecl *owner = BorrowContext::getKeyForDecl(move.target->getDecl());
+        if (reportConflicts && isBorrowed(owner, live, conflictLoc))
+          report(BorrowDiag::MoveIntoWhileBorrowed, move.target->getExprLoc(), owner, conflictLoc);
+        live.reset(movedIndex.lookup(owner));
+      }
+      if (move.source)
+      {
+        const ValueDecl *owner = BorrowContext::getKeyForDecl(move.source->getDecl());
+        if (reportConflicts && isBorrowed(owner, live, conflictLoc))
+          report(BorrowDiag::MoveWhileBorrowed, move.source->getExprLoc(), owner, conflictLoc);
+        live.set(movedIndex.lookup(owner));
+      }
+    }
+
+    // Reports a use of an owner that may have been moved from
+    void checkUse(const DeclRefExpr *ref, const llvm::BitVector &live)
+    {
+      if (moveOperands.count(ref))
+        return;
+      const ValueDecl *var = BorrowContext::getKeyForDecl(ref->getDecl());
+      auto index = movedIndex.find(var);
+      if (index != movedIndex.end())
+      {
+        if (live.test(index->second))
+          report(BorrowDiag::UseAfterMove, ref->getLocation(), var, moveSites[index->second - borrowers.size()]);
+        return;
+      }
+      auto global = globals.find(var);
+      if (global != globals.end() && global->second.movedAt.isValid())
+        report(BorrowDiag::UseAfterMove, ref->getLocation(), var, global->second.movedAt);
+    }
+
+    void report(BorrowDiag diag, SourceLocation loc, const NamedDecl *var, SourceLocation conflictLoc)
+    {
+      diags.push_back({loc, diag, var, {}, conflictLoc, function});
+    }
+
+    // Keeps the first maxDiags violations in source order, then the note that
+    // the rest were skipped, as the lexical engine does. Blocks are reported in
+    // the CFG's order, which is roughly the reverse of the source.
+    void applyDiagLimit()
+    {
+      const SourceManager &SM = Context.getSourceManager();
+      std::stable_sort(diags.begin(), diags.end(),
+                       [&SM](const PendingDiag &a, const PendingDiag &b)
+                       { return SM.isBeforeInTranslationUnit(a.loc, b.loc); });
+      if (maxDiags == 0 || diags.size() < maxDiags)
+        return;
+      diags.resize(maxDiags);
+      SourceLocation last = diags.back().loc;
+      diags.push_back({last, BorrowDiag::TooManyErrors, function, {}, {}, function});
+    }
+
+    // Declaration of the first live borrower in mask, if any. Borrows held by
+    // globals have no borrower in this function.
+    SourceLocation conflictingBorrow(const llvm::BitVector &live, const llvm::BitVector &mask) const
+    {
+      llvm::BitVector common = live;
+      common &= mask;
+      int index = common.find_first();
+      return index < 0 ? SourceLocation() : borrowers[index].var->getLocation();
+    }
+
+    // Checks a borrow against the live borrowers of the same owner and the
+    // borrows globals already hold
+    void checkBorrow(const CallExpr *call, const llvm::BitVector &live)
+    {
+      const ValueDecl *owner = nullptr;
+      BorrowKind kind = ownership.classifyBorrowCall(call, owner);
+      if (kind == BorrowKind::None)
+        return;
+      checkedBorrows++;
+
+      bool liveImmutable = false, liveMutable = false;
+      auto masks = ownerMasks.find(owner);
+      const OwnerMasks *ownerMask = masks != ownerMasks.end() ? &masks->second : nullptr;
+      if (ownerMask)
+      {
+        liveImmutable = live.anyCommon(ownerMask->immutable);
+        liveMutable = live.anyCommon(ownerMask->mutableBorrows);
+      }
+      auto global = globals.find(owner);
+      if (global != globals.end())
+      {
+        liveImmutable |= global->second.immutablyBorrowed > 0;
+        liveMutable |= global->second.mutablyBorrowed > 0;
+      }
+
+      SourceLocation loc = call->getExprLoc();
+      auto conflict = [&](bool isMutable)
+      {
+        if (!ownerMask)
+          return SourceLocation();
+        return conflictingBorrow(live, isMutable ? ownerMask->mutableBorrows : ownerMask->immutable);
+      };
+      if (kind == BorrowKind::Immutable && liveMutable)
+        report(BorrowDiag::ImmutableWhileMutable, loc, owner, conflict(true));
+      else if (kind == BorrowKind::Mutable && liveImmutable)
+        report(BorrowDiag::MutableWhileImmutable, loc, owner, conflict(false));
+      else if (kind == BorrowKind::Mutable && liveMutable)
+        report(BorrowDiag::MutableWhileMutable, loc, owner, conflict(true));
+    }
+
+    // Applies a block's effects to live, reporting conflicts when asked
+    void transfer(const CFGBlock &block, llvm::BitVector &live, bool reportConflicts)
+    {
+      for (const CFGElement &element : block)
+      {
+        if (auto stmt = element.getAs<CFGStmt>())
+        {
+          if (const auto *call = dyn_cast<CallExpr>(stmt->getStmt()))
+          {
+            if (reportConflicts)
+              checkBorrow(call, live);
+            // A borrower assigned a new value gives up its borrow. The borrow
+            // on the right was checked as its own element, but is not followed.
+            if (const DeclRefExpr *reassigned = ownership.reassignedBorrower(call))
+            {
+              auto index = borrowerIndex.find(dyn_cast<VarDecl>(reassigned->getDecl()));
+              if (index != borrowerIndex.end())
+                live.reset(index->second);
+            }
+          }
+          else if (const auto *ref = dyn_cast<DeclRefExpr>(stmt->getStmt()))
+          {
+            if (reportConflicts)
+              checkUse(ref, live);
+          }
+          else if (const auto *declStmt = dyn_cast<DeclStmt>(stmt->getStmt()))
+          {
+            for (const Decl *decl : declStmt->decls())
+            {
+              auto index = borrowerIndex.find(dyn_cast<VarDecl>(decl));
+              if (index != borrowerIndex.end())
+                live.set(index->second);
+              // An owner declared again, as in a loop body, holds a new value
+              const auto *var = dyn_cast<VarDecl>(decl);
+              auto moved = var ? movedIndex.find(BorrowContext::getKeyForDecl(var)) : movedIndex.end();
+              if (moved != movedIndex.end())
+                live.reset(moved->second);
+            }
+          }
+          applyMove(stmt->getStmt(), live, reportConflicts);
+        }
+        else if (auto dtor = element.getAs<CFGAutomaticObjDtor>())
+        {
+          auto index = borrowerIndex.find(dtor->getVarDecl());
+          if (index != borrowerIndex.end())
+            live.reset(index->second);
+        }
+        // Borrowers are trivially destructible under OWNERSHIP_UNCHECKED and
+        // have no destructor element, so their borrow ends with their lifetime
+        else if (auto lifetime = element.getAs<CFGLifetimeEnds>())
+        {
+          auto index = borrowerIndex.find(lifetime->getVarDecl());
+          if (index != borrowerIndex.end())
+            live.reset(index->second);
+        }
+      }
+    }
+
+  public:
+    CFGBorrowAnalysis(ASTContext &ctx, const OwnershipDecls &od,
+                      const BorrowStateMap &globalStates, unsigned maxDiagsPerFunction)
+        : Context(ctx), ownership(od), globals(globalStates), maxDiags(maxDiagsPerFunction) {}
+
+    // Analyzes func; returns false if no CFG could be built for it. Building a
+    // CFG runs the constant evaluator, which fills ASTContext caches such as
+    // record layouts without synchronization, so callers on several threads
+    // share one buildMutex; the dataflow itself runs unlocked.
+    bool run(const FunctionDecl *func, std::mutex &buildMutex)
+    {
+      function = func;
+      CFG::BuildOptions buildOptions;
+      buildOptions.AddImplicitDtors = true;
+      buildOptions.AddLifetime = true;
+      // Uses of moved-from owners are found on DeclRefExpr elements, which the
+      // CFG leaves out unless asked for
+      buildOptions.setAlwaysAdd(Stmt::DeclRefExprClass);
+      std::unique_ptr<CFG> cfg;
+      {
+        std::lock_guard<std::mutex> lock(buildMutex);
+        cfg = CFG::buildCFG(func, func->getBody(), &Context, buildOptions);
+      }
+      if (!cfg)
+        return false;
+      numBlocks = cfg->getNumBlockIDs();
+
+      indexBorrowers(*cfg);
+
+      // Iterate to a fixpoint; the state at a block's entry is the union of its predecessors'
+      std::vector<llvm::BitVector> entryStates(cfg->getNumBlockIDs(), llvm::BitVector(stateSize()));
+      // Globals moved from at TU level start out moved
+      for (const auto &owner : movedIndex)
+      {
+        auto global = globals.find(owner.first);
+        if (global != globals.end() && global->second.movedAt.isValid())
+          entryStates[cfg->getEntry().getBlockID()].set(owner.second);
+      }
+      std::vector<bool> reached(cfg->getNumBlockIDs(), false);
+      std::vector<bool> queued(cfg->getNumBlockIDs(), false);
+      std::deque<const CFGBlock *> worklist;
+      worklist.push_back(&cfg->getEntry());
+      reached[cfg->getEntry().getBlockID()] = true;
+      while (!worklist.empty())
+      {
+        const CFGBlock *block = worklist.front();
+        worklist.pop_front();
+        queued[block->getBlockID()] = false;
+
+        llvm::BitVector live = entryStates[block->getBlockID()];
+        transfer(*block, live, false);
+        for (const CFGBlock *succ : block->succs())
+        {
+          if (!succ)
+            continue;
+          unsigned id = succ->getBlockID();
+          llvm::BitVector merged = entryStates[id];
+          merged |= live;
+          if (reached[id] && merged == entryStates[id])
+            continue;
+          reached[id] = true;
+          entryStates[id] = std::move(merged);
+          if (!queued[id])
+          {
+            queued[id] = true;
+            worklist.push_back(succ);
+          }
+        }
+      }
+
+      // Report once per borrow site using the fixpoint states
+      for (const CFGBlock *block : *cfg)
+      {
+        if (!reached[block->getBlockID()])
+          continue;
+        llvm::BitVector live = entryStates[block->getBlockID()];
+        transfer(*block, live, true);
+      }
+      applyDiagLimit();
+      return true;
+    }
+
+    std::vector<PendingDiag> takeDiagnostics() { return std::move(diags); }
+
+    // Block count and borrow calls checked in the last function run, for -stats
+    unsigned blockCount() const { return numBlocks; }
+    unsigned borrowCount() const { return checkedBorrows; }
+  };
+
+  // A diagnostic as the result caches keep it, relative to the start of its
+  // function; conflict is -1 when the conflicting borrow is not kept
+  struct CachedDiag
+  {
+    BorrowDiag diag;
+    unsigned offset;
+    int conflict;
+    std::string name;
+  };
+
+  // Converts a function's diagnostics to cached form; false if a diagnostic is
+  // not in the same file as base
+  bool encodeCachedDiags(SourceLocation base, const std::vector<PendingDiag> &diags, ASTContext &ctx,
+                         std::vector<CachedDiag> &cached)
+  {
+    const SourceManager &SM = ctx.getSourceManager();
+    std::pair<FileID, unsigned> start = SM.getDecomposedLoc(base);
+    for (const PendingDiag &pending : diags)
+    {
+      if (!pending.loc.isFileID() || !pending.decl)
+        return false;
+      std::pair<FileID, unsigned> at = SM.getDecomposedLoc(pending.loc);
+      if (at.first != start.first || at.second < start.second)
+        return false;
+      // A conflicting borrow outside the function, e.g. held by a global, is not kept
+      int conflict = -1;
+      if (pending.conflictLoc.isFileID())
+      {
+        std::pair<FileID, unsigned> conflictAt = SM.getDecomposedLoc(pending.conflictLoc);
+        if (conflictAt.first == start.first && conflictAt.second >= start.second)
+          conflict = conflictAt.second - start.second;
+      }
+      std::string name;
+      llvm::raw_string_ostream os(name);
+      pending.decl->getNameForDiagnostic(os, ctx.getPrintingPolicy(), false);
+      cached.push_back({pending.diag, at.second - start.second, conflict, os.str()});
+    }
+    return true;
+  }
+
+  // Replays cached diagnostics in func
+  std::vector<PendingDiag> decodeCachedDiags(const FunctionDecl *func, const std::vector<CachedDiag> &cached)
+  {
+    SourceLocation base = func->getBeginLoc();
+    std::vector<PendingDiag> diags;
+    for (const CachedDiag &entry : cached)
+    {
+      SourceLocation conflictLoc = entry.conflict < 0 ? SourceLocation() : base.getLocWithOffset(entry.conflict);
+      diags.push_back({base.getLocWithOffset(entry.offset), entry.diag, nullptr, entry.name, conflictLoc, func});
+    }
+    return diags;
+  }
+
+  // On-disk cache of per-function verdicts. Entries are keyed by a hash of the
+  // function and everything else its verdict depends on, and store each
+  // diagnostic as an offset from the start of the function.
+  class BorrowResultCache
+  {
+    static constexpr llvm::StringLiteral Header = "borrow-check-cache 2";
+    std::string directory;
+    bool directoryReady = false;
+
+    std::string entryPath(uint64_t key) const
+    {
+      llvm::SmallString<128> path(directory);
+      llvm::sys::path::append(path, llvm::Twine::utohexstr(key) + ".bcc");
+      return std::string(path);
+    }
+
+  public:
+    explicit BorrowResultCache(std::string dir) : directory(std::move(dir)) {}
+
+    bool enabled() const { return !directory.empty(); }
+
+    // Reads the entry for key; false if there is no valid entry
+    bool load(uint64_t key, std::vector<CachedDiag> &cached) const
+    {
+      auto buffer = llvm::MemoryBuffer::getFile(entryPath(key));
+      if (!buffer)
+        return false;
+
+      llvm::SmallVector<llvm::StringRef, 8> lines;
+      (*buffer)->getBuffer().split(lines, '\n', -1, false);
+      if (lines.empty() || lines.front() != Header)
+        return false;
+
+      std::vector<CachedDiag> loaded;
+      for (llvm::StringRef line : llvm::ArrayRef<llvm::StringRef>(lines).drop_front())
+      {
+        llvm::StringRef kindText, offsetText, conflictText, name;
+        std::tie(kindText, line) = line.split(' ');
+        std::tie(offsetText, line) = line.split(' ');
+        std::tie(conflictText, name) = line.split(' ');
+        unsigned kind, offset;
+        int conflict;
+        if (kindText.getAsInteger(10, kind) || offsetText.getAsInteger(10, offset) ||
+            conflictText.getAsInteger(10, conflict) || kind >= static_cast<unsigned>(BorrowDiag::NumDiags))
+          return false;
+        loaded.push_back({static_cast<BorrowDiag>(kind), offset, conflict, name.str()});
+      }
+      cached = std::move(loaded);
+      return true;
+    }
+
+    // Writes an entry for key
+    void store(uint64_t key, const std::vector<CachedDiag> &cached)
+    {
+      std::string contents;
+      llvm::raw_string_ostream os(contents);
+      os << Header << '\n';
+      for (const CachedDiag &entry : cached)
+        os << static_cast<unsigned>(entry.diag) << ' ' << entry.offset << ' ' << entry.conflict << ' ' << entry.name << '\n';
+      os.flush();
+
+      if (!directoryReady)
+      {
+        if (llvm::sys::fs::create_directories(directory))
+          return;
+        directoryReady = true;
+      }
+
+      // Write to a unique file and rename it so concurrent compiles never see partial entries
+      std::string path = entryPath(key);
+      int fd;
+      llvm::SmallString<128> tempPath;
+      if (llvm::sys::fs::createUniqueFile(path + ".tmp-%%%%%%", fd, tempPath))
+        return;
+      bool written;
+      {
+        llvm::raw_fd_ostream out(fd, /*shouldClose=*/true);
+        out << contents;
+        out.close();
+        written = !out.has_error();
+        out.clear_error();
+      }
+      if (!written || llvm::sys::fs::rename(tempPath, path))
+        llvm::sys::fs::remove(tempPath);
+    }
+  };
+
+  // Per-function verdicts kept in memory for -incremental. Editor tooling
+  // reparses a file on every edit in one long-lived process, so functions whose
+  // key is unchanged are replayed from here. Shared by every TU the process
+  // checks, possibly concurrently.
+  class IncrementalResultCache
+  {
+    static constexpr size_t MaxEntries = 1 << 16; // Dropped all at once when reached
+    std::mutex mutex;
+    std::unordered_map<uint64_t, std::vector<CachedDiag>> entries;
+
+  public:
+    static IncrementalResultCache &shared()
+    {
+      static IncrementalResultCache cache;
+      return cache;
+    }
+
+    bool load(uint64_t key, std::vector<CachedDiag> &cached)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = entries.find(key);
+      if (found == entries.end())
+        return false;
+      cached = found->second;
+      return true;
+    }
+
+    void store(uint64_t key, std::vector<CachedDiag> cached)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (entries.size() >= MaxEntries)
+        entries.clear();
+      entries[key] = std::move(cached);
+    }
+  };
+
+  class BorrowCheckConsumer : public ASTConsumer
+  {
+    BorrowCheckOptions options;
+    BorrowDiagnostics diagnostics;
+    BorrowContext borrowContext;
+    OwnershipDecls ownership;
+    BorrowResultCache cache;
+    SummaryIndex summaries;
+    ASTContext &astContext;
+    BorrowCheckStats stats;
+    mutable std::mutex cfgBuildMutex; // Serializes CFG construction across -jobs workers
+
+    // Top-level decls in system headers or outside the allowlist can never
+    // contain borrows we report, so they are pruned before traversal
+    bool shouldSkipDecl(const Decl *decl) const
+    {
+      const SourceManager &SM = astContext.getSourceManager();
+      SourceLocation loc = SM.getExpansionLoc(decl->getLocation());
+      if (loc.isInvalid())
+        return false;
+      if (options.skipSystemHeaders && SM.isInSystemHeader(loc))
+        return true;
+      if (!options.restrictToAllowedPaths || SM.isInMainFile(loc))
+        return false;
+
+      llvm::StringRef fileName = SM.getFilename(loc);
+      for (const std::string &prefix : options.allowedPaths)
+      {
+        if (fileName.take_front(prefix.size()) == prefix)
+          return false;
+      }
+      return true;
+    }
+
+  public:
+    explicit BorrowCheckConsumer(ASTContext &Context, const BorrowCheckOptions &opts)
+        : options(opts), diagnostics(Context.getDiagnostics()),
+          borrowContext(opts.maxDiagsPerFunction), cache(opts.cacheDir), astContext(Context)
+    {
+      for (const std::string &path : opts.summaryPaths)
+        summaries.addPath(path);
+      diagnostics.report(BorrowDiag::PluginRunning, SourceLocation());
+    }
+
+    void HandleTranslationUnit(ASTContext &Context) override
+    {
+      llvm::TimeTraceScope timeScope("BorrowCheck");
+      borrowContext.clear(); // Clear the context
+      stats = BorrowCheckStats();
+      if (!ownership.lookup(Context))
+        return; // Nothing to check without ownership.h
+
+      // Build the TU-level (global) state first, collecting function bodies
+      auto start = std::chrono::steady_clock::now();
+      std::vector<FunctionDecl *> functions;
+      BorrowCheckerVisitor visitor(borrowContext, ownership);
+      visitor.deferFunctionsTo(&functions);
+      if (summaries.enabled())
+        visitor.useSummaries(&summaries);
+      if (options.escapeAnalysis)
+        visitor.checkEscapes();
+      for (Decl *decl : Context.getTranslationUnitDecl()->decls())
+      {
+        if (shouldSkipDecl(decl))
+          continue;
+        visitor.TraverseDecl(decl);
+      }
+      stats.merge(borrowContext.stats());
+      auto globalsDone = std::chrono::steady_clock::now();
+      stats.globalSeconds = std::chrono::duration<double>(globalsDone - start).count();
+
+      std::vector<PendingDiag> diags = borrowContext.takeDiagnostics();
+      analyzeFunctions(functions, diags);
+      stats.functionSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - globalsDone).count();
+      emitDiagnostics(diags);
+      if (!options.summaryOut.empty())
+        writeSummaries(functions);
+      if (options.printStats)
+        printStats(llvm::errs());
+      if (options.incremental)
+        printLatency(llvm::errs(), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+                     functions.size());
+    }
+
+  private:
+    // Analyzes each function body in its own context on top of the global
+    // state, on a thread pool when -jobs allows it
+    void analyzeFunctions(const std::vector<FunctionDecl *> &functions,
+                          std::vector<PendingDiag> &diags)
+    {
+      std::vector<std::vector<PendingDiag>> results(functions.size());
+      std::vector<std::optional<uint64_t>> cacheKeys(functions.size());
+      std::vector<BorrowCheckStats> functionStats(functions.size());
+      std::vector<size_t> toAnalyze;
+
+      // Functions with a cached verdict are replayed instead of traversed,
+      // from memory under -incremental and then from -cache-dir
+      IncrementalResultCache *memory = options.incremental ? &IncrementalResultCache::shared() : nullptr;
+      uint64_t globalsHash = cache.enabled() || memory ? hashGlobalStates() : 0;
+      for (size_t i = 0; i < functions.size(); ++i)
+      {
+        if (cache.enabled() || memory)
+          cacheKeys[i] = cacheKeyFor(functions[i], globalsHash);
+        std::vector<CachedDiag> cached;
+        if (cacheKeys[i] && memory && memory->load(*cacheKeys[i], cached))
+        {
+          results[i] = decodeCachedDiags(functions[i], cached);
+          stats.reusedFunctions++;
+          continue;
+        }
+        if (cacheKeys[i] && cache.enabled() && cache.load(*cacheKeys[i], cached))
+        {
+          results[i] = decodeCachedDiags(functions[i], cached);
+          stats.cachedFunctions++;
+          if (memory)
+            memory->store(*cacheKeys[i], std::move(cached));
+          continue;
+        }
+        toAnalyze.push_back(i);
+      }
+
+      auto analyze = [&](size_t index)
+      {
+        FunctionDecl *func = functions[index];
+        llvm::TimeTraceScope timeScope("BorrowCheckFunction", [func]
+                                       { return func->getQualifiedNameAsString(); });
+        analyzeFunction(func, results[index], functionStats[index]);
+      };
+
+      // Decls from an external AST source deserialize lazily, which is not thread-safe
+      if (options.jobs == 1 || toAnalyze.size() < 2 || astContext.getExternalSource())
+      {
+        for (size_t index : toAnalyze)
+          analyze(index);
+      }
+      else
+      {
+        llvm::ThreadPool pool(llvm::hardware_concurrency(options.jobs));
+        for (size_t index : toAnalyze)
+          pool.async(analyze, index);
+        pool.wait();
+      }
+
+      for (size_t index : toAnalyze)
+      {
+        std::vector<CachedDiag> cached;
+        if (!cacheKeys[index] ||
+            !encodeCachedDiags(functions[index]->getBeginLoc(), results[index], astContext, cached))
+          continue;
+        if (cache.enabled())
+          cache.store(*cacheKeys[index], cached);
+        if (memory)
+          memory->store(*cacheKeys[index], std::move(cached));
+      }
+
+      for (std::vector<PendingDiag> &result : results)
+        diags.insert(diags.end(), result.begin(), result.end());
+      for (const BorrowCheckStats &functionStat : functionStats)
+        stats.merge(functionStat);
+    }
+
+    // The instantiated definitions of a template pattern: the specializations
+    // of a function template, or one member of each class template specialization
+    static std::vector<FunctionDecl *> instantiationsOf(const FunctionDecl *pattern)
+    {
+      std::vector<FunctionDecl *> instantiations;
+      auto add = [&](FunctionDecl *func)
+      {
+        const FunctionDecl *from = func->getTemplateInstantiationPattern();
+        if (from && from->getCanonicalDecl() == pattern->getCanonicalDecl() &&
+            func->doesThisDeclarationHaveABody())
+          instantiations.push_back(func);
+      };
+      if (const FunctionTemplateDecl *ftd = pattern->getDescribedFunctionTemplate())
+      {
+        for (FunctionDecl *spec : ftd->specializations())
+          add(spec);
+        return instantiations;
+      }
+      const auto *method = dyn_cast<CXXMethodDecl>(pattern);
+      const ClassTemplateDecl *ctd = method ? method->getParent()->getDescribedClassTemplate() : nullptr;
+      if (!ctd)
+        return instantiations;
+      for (ClassTemplateSpecializationDecl *spec : ctd->specializations())
+      {
+        for (Decl *member : spec->decls())
+        {
+          if (auto *func = dyn_cast<FunctionDecl>(member))
+            add(func);
+        }
+      }
+      return instantiations;
+    }
+
+    // Checks one function body, adding to diags and functionStats. Templates
+    // are not analyzed by the CFG engine, and a failed CFG build falls back.
+    void analyzeFunction(FunctionDecl *func, std::vector<PendingDiag> &diags, BorrowCheckStats &functionStats) const
+    {
+      if (options.flowSensitive && !func->isDependentContext())
+      {
+        CFGBorrowAnalysis flow(astContext, ownership, borrowContext.states(), options.maxDiagsPerFunction);
+        if (flow.run(func, cfgBuildMutex))
+        {
+          std::vector<PendingDiag> found = flow.takeDiagnostics();
+          diags.insert(diags.end(), found.begin(), found.end());
+          BorrowCheckStats fs;
+          fs.functions = fs.cfgFunctions = 1;
+          fs.cfgBlocks = flow.blockCount();
+          fs.borrows = flow.borrowCount();
+          functionStats.merge(fs);
+          return;
+        }
+      }
+
+      BorrowContext local(options.maxDiagsPerFunction, &borrowContext.states());
+      BorrowCheckerVisitor worker(local, ownership);
+      if (summaries.enabled())
+        worker.useSummaries(&summaries);
+      if (options.escapeAnalysis)
+        worker.checkEscapes();
+      worker.TraverseDecl(func);
+      std::vector<PendingDiag> found = local.takeDiagnostics();
+      diags.insert(diags.end(), found.begin(), found.end());
+      local.stats().functions = 1;
+      functionStats.merge(local.stats());
+
+      // A template is checked once for all its instantiations, unless a borrow
+      // in it depends on the template arguments
+      if (worker.needsInstantiations())
+      {
+        for (FunctionDecl *instantiation : instantiationsOf(func))
+        {
+          functionStats.instantiations++;
+          analyzeFunction(instantiation, diags, functionStats);
+        }
+      }
+    }
+
+    // Prints the -stats report for this TU
+    void printStats(llvm::raw_ostream &os) const
+    {
+      const SourceManager &SM = astContext.getSourceManager();
+      const FileEntry *mainFile = SM.getFileEntryForID(SM.getMainFileID());
+      os << "*** Borrow check statistics for " << (mainFile ? mainFile->getName() : "<unknown>") << ":\n";
+      os << "  " << stats.functions << " functions analyzed (" << stats.cfgFunctions << " by the CFG engine, "
+         << stats.cfgBlocks << " CFG blocks)\n";
+      os << "  " << stats.cachedFunctions << " functions replayed from the result cache, "
+         << stats.reusedFunctions << " reused from the previous run\n";
+      os << "  " << stats.instantiations << " template instantiations analyzed separately\n";
+      os << "  " << stats.varDecls << " VisitVarDecl hits, " << stats.callExprs << " VisitCallExpr hits\n";
+      os << "  " << stats.trackedVariables << " tracked variables, " << stats.borrows << " borrows checked\n";
+      os << "  " << stats.peakScopeDepth << " peak scope depth, " << stats.peakLiveBorrows
+         << " peak live borrows, " << stats.peakStateEntries << " peak state map entries\n";
+      os << "  " << borrowContext.states().size() << " TU-level state map entries\n";
+      os << "  " << llvm::format("%.3f", stats.globalSeconds * 1000) << " ms traversing TU-level declarations, "
+         << llvm::format("%.3f", stats.functionSeconds * 1000) << " ms analyzing functions\n";
+    }
+
+    // One line per run for -incremental: the check's wall-clock overhead and
+    // how many function bodies it had to analyze again
+    void printLatency(llvm::raw_ostream &os, double seconds, size_t numFunctions) const
+    {
+      const SourceManager &SM = astContext.getSourceManager();
+      const FileEntry *mainFile = SM.getFileEntryForID(SM.getMainFileID());
+      os << "borrow-check: " << (mainFile ? mainFile->getName() : "<unknown>") << ": "
+         << llvm::format("%.3f", seconds * 1000) << " ms, " << (numFunctions - stats.reusedFunctions - stats.cachedFunctions) << " of "
+         << numFunctions << " functions analyzed\n";
+    }
+
+    // Records the ownership effects of this TU's externally visible functions
+    // for callers in other TUs
+    void writeSummaries(const std::vector<FunctionDecl *> &functions)
+    {
+      std::vector<std::pair<uint64_t, std::vector<uint8_t>>> records;
+      ParamEffectVisitor effects(ownership);
+      for (FunctionDecl *func : functions)
+      {
+        if (func->isDependentContext() || !func->isExternallyVisible())
+          continue;
+        std::vector<uint8_t> paramEffects = effects.run(func);
+        std::optional<uint64_t> key = paramEffects.empty() ? std::nullopt : summaryKeyFor(func);
+        if (key)
+          records.push_back({*key, std::move(paramEffects)});
+      }
+      if (!SummaryIndex::write(options.summaryOut, std::move(records)))
+      {
+        DiagnosticsEngine &DE = astContext.getDiagnostics();
+        DE.Report(DE.getCustomDiagID(DiagnosticsEngine::Warning, "Cannot write borrow-check summary '%0'"))
+            << options.summaryOut;
+      }
+    }
+
+    // Hashes the TU-level borrow state every function's verdict starts from,
+    // and the cross-TU summaries calls are checked against
+    uint64_t hashGlobalStates() const
+    {
+      std::vector<std::string> entries;
+      for (const auto &entry : borrowContext.states())
+      {
+        std::string text;
+        llvm::raw_string_ostream os(text);
+        os << entry.first->getQualifiedNameAsString() << ' ' << entry.second.mutablyBorrowed
+           << ' ' << entry.second.immutablyBorrowed << ' ' << entry.second.movedAt.isValid();
+        entries.push_back(os.str());
+      }
+      std::sort(entries.begin(), entries.end());
+
+      std::string data;
+      for (const std::string &entry : entries)
+        data += entry + '\n';
+      if (summaries.enabled())
+        data += llvm::Twine::utohexstr(summaries.fingerprint()).str();
+      return llvm::xxHash64(data);
+    }
+
+    // Key for a function's cached verdict: its name, source text and ODR hash,
+    // plus the options and global state the verdict depends on. Templates and
+    // functions spelled through macros are not cached.
+    std::optional<uint64_t> cacheKeyFor(FunctionDecl *func, uint64_t globalsHash) const
+    {
+      if (func->isDependentContext() || !func->getBeginLoc().isFileID())
+        return std::nullopt;
+
+      bool invalid = false;
+      llvm::StringRef text = Lexer::getSourceText(CharSourceRange::getTokenRange(func->getSourceRange()),
+                                                  astContext.getSourceManager(),
+                                                  astContext.getLangOpts(), &invalid);
+      if (invalid || text.empty())
+        return std::nullopt;
+
+      std::string data;
+      llvm::raw_string_ostream os(data);
+      os << func->getQualifiedNameAsString() << '\0' << func->getODRHash() << '\0'
+         << options.maxDiagsPerFunction << '\0' << options.flowSensitive << '\0'
+         << options.escapeAnalysis << '\0' << globalsHash << '\0' << text;
+      return llvm::xxHash64(os.str());
+    }
+
+    // Reports the merged violations in source order
+    void emitDiagnostics(std::vector<PendingDiag> &diags)
+    {
+      const SourceManager &SM = astContext.getSourceManager();
+      // Ties on a location are broken by kind and name, so that std::unique below
+      // sees every copy of a violation next to each other
+      std::stable_sort(diags.begin(), diags.end(),
+                       [&SM](const PendingDiag &a, const PendingDiag &b)
+                       {
+                         if (a.loc != b.loc)
+                           return SM.isBeforeInTranslationUnit(a.loc, b.loc);
+                         if (a.diag != b.diag)
+                           return a.diag < b.diag;
+                         return a.name() < b.name();
+                       });
+      // A template and its instantiations share source locations, so a violation
+      // found in several of them is reported once
+      diags.erase(std::unique(diags.begin(), diags.end(),
+                              [](const PendingDiag &a, const PendingDiag &b)
+                              { return a.loc == b.loc && a.diag == b.diag && a.name() == b.name(); }),
+                  diags.end());
+      for (const PendingDiag &pending : diags)
+        diagnostics.report(pending);
+      if (!options.diagJsonPath.empty())
+        writeJsonDiagnostics(diags);
+    }
+
+    // Appends one JSON object per diagnostic to -diag-jsonl. The TU's records are
+    // written with a single call, so TUs compiled in parallel into one file do not
+    // interleave within a line.
+    void writeJsonDiagnostics(const std::vector<PendingDiag> &diags)
+    {
+      const SourceManager &SM = astContext.getSourceManager();
+      std::string records;
+      llvm::raw_string_ostream os(records);
+      auto location = [&SM](llvm::json::OStream &json, SourceLocation loc)
+      {
+        PresumedLoc presumed = SM.getPresumedLoc(SM.getExpansionLoc(loc));
+        if (!presumed.isValid())
+        {
+          json.value(nullptr);
+          return;
+        }
+        json.object([&]
+                    {
+                      json.attribute("file", presumed.getFilename());
+                      json.attribute("line", presumed.getLine());
+                      json.attribute("column", presumed.getColumn()); });
+      };
+      for (const PendingDiag &pending : diags)
+      {
+        llvm::json::OStream json(os);
+        json.object([&]
+                    {
+                      json.attribute("code", BorrowDiagnostics::code(pending.diag));
+                      json.attribute("severity", BorrowDiagnostics::severity(pending.diag));
+                      json.attribute("message", diagnostics.message(pending));
+                      json.attributeBegin("location");
+                      location(json, pending.loc);
+                      json.attributeEnd();
+                      json.attribute("owner", pending.name());
+                      json.attributeBegin("conflict");
+                      location(json, pending.conflictLoc);
+                      json.attributeEnd();
+                      if (pending.function)
+                        json.attribute("function", pending.function->getQualifiedNameAsString());
+                      else
+                        json.attribute("function", nullptr); });
+        os << '\n';
+      }
+      if (os.str().empty())
+        return;
+
+      std::error_code error;
+      std::unique_ptr<llvm::raw_fd_ostream> file;
+      llvm::StringRef path = options.diagJsonPath;
+      int fd;
+      if (path == "-")
+        file = std::make_unique<llvm::raw_fd_ostream>(1, false);
+      else if (path.consume_front("fd:") && !path.getAsInteger(10, fd))
+        file = std::make_unique<llvm::raw_fd_ostream>(fd, false);
+      else
+        file = std::make_unique<llvm::raw_fd_ostream>(options.diagJsonPath, error, llvm::sys::fs::OF_Append);
+      if (!error)
+      {
+        // Unbuffered so the whole TU goes out in one write(2) of O_APPEND data
+        file->SetUnbuffered();
+        *file << os.str();
+        file->flush();
+        error = file->error();
+        file->clear_error();
+      }
+      if (error)
+      {
+        DiagnosticsEngine &DE = astContext.getDiagnostics();
+        DE.Report(DE.getCustomDiagID(DiagnosticsEngine::Warning, "Cannot write borrow diagnostics to '%0': %1"))
+            << options.diagJsonPath << error.message();
+      }
+    }
+  };
+
+  class BorrowCheckAction : public PluginASTAction
+  {
+    BorrowCheckOptions options;
+
+  protected:
+    std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                   llvm::StringRef inFile) override
+    {
+      // -emit-summary writes foo.o.bcsum next to foo.o, or foo.bcsum without an output file
+      BorrowCheckOptions opts = options;
+      if (opts.emitSummary && opts.summaryOut.empty())
+      {
+        const std::string &output = CI.getFrontendOpts().OutputFile;
+        llvm::SmallString<128> path(llvm::sys::path::filename(inFile));
+        llvm::sys::path::replace_extension(path, "bcsum");
+        opts.summaryOut = !output.empty() && output != "-" ? output + ".bcsum" : std::string(path);
+      }
+      return std::make_unique<BorrowCheckConsumer>(CI.getASTContext(), opts);
+    }
+
+    // -plugin borrow-check replaces code generation, while -add-plugin borrow-check
+    // runs the check before the main action in the same frontend invocation
+    ActionType getActionType() override
+    {
+      return CmdlineBeforeMainAction;
+    }
+
+    bool ParseArgs(const CompilerInstance &CI,
+                   const std::vector<std::string> &args) override
+    {
+      for (const std::string &arg : args)
+      {
+        if (!parseArg(arg))
+        {
+          DiagnosticsEngine &DE = CI.getDiagnostics();
+          unsigned ID = DE.getCustomDiagID(DiagnosticsEngine::Error,
+                                           "Invalid borrow-check argument '%0'");
+          DE.Report(ID) << arg;
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // Applies one plugin argument to options; returns false if it is not recognized
+    bool parseArg(llvm::StringRef arg)
+    {
+      if (arg == "-analyze-system-headers")
+      {
+        options.skipSystemHeaders = false;
+        return true;
+      }
+      if (arg == "-main-file-only")
+      {
+        options.restrictToAllowedPaths = true;
+        return true;
+      }
+      if (arg.consume_front("-allow-path="))
+      {
+        options.restrictToAllowedPaths = true;
+        options.allowedPaths.push_back(arg.str());
+        return true;
+      }
+      if (arg.consume_front("-max-diags-per-function="))
+        return !arg.getAsInteger(10, options.maxDiagsPerFunction);
+      if (arg.consume_front("-jobs="))
+        return !arg.getAsInteger(10, options.jobs);
+      if (arg == "-engine=cfg" || arg == "-engine=lexical")
+      {
+        options.flowSensitive = arg == "-engine=cfg";
+        return true;
+      }
+      if (arg == "-emit-summary")
+      {
+        options.emitSummary = true;
+        return true;
+      }
+      if (arg.consume_front("-summary-out="))
+      {
+        options.summaryOut = arg.str();
+        return !arg.empty();
+      }
+      if (arg.consume_front("-summaries="))
+      {
+        options.summaryPaths.push_back(arg.str());
+        return !arg.empty();
+      }
+      if (arg == "-escape-analysis")
+      {
+        options.escapeAnalysis = true;
+        return true;
+      }
+      if (arg == "-stats")
+      {
+        options.printStats = true;
+        return true;
+      }
+      if (arg.consume_front("-diag-jsonl="))
+      {
+        options.diagJsonPath = arg.str();
+        return !arg.empty();
+      }
+      if (arg == "-incremental")
+      {
+        options.incremental = true;
+        return true;
+      }
+      if (arg.consume_front("-cache-dir="))
+      {
+        options.cacheDir = arg.str();
+        return !arg.empty();
+      }
+      return false;
     }
   };
 
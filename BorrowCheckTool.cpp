@@ -0,0 +1,271 @@
+// BorrowCheckTool.cpp
+// Runs the borrow-check plugin over every TU of a compilation database in one
+// process, on several worker threads, and prints a single deduplicated report.
+//
+//   borrow-check-tool -p build [-j N] [--plugin-arg=<arg>...] [files...]
+//
+// Without files, every file in compile_commands.json is checked. The plugin
+// action is linked in from BorrowCheckPlugin.cpp and found through the plugin
+// registry, so the tool and the loadable plugin always run the same analysis.
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace clang;
+
+namespace
+{
+
+  llvm::cl::OptionCategory toolCategory("borrow-check-tool options");
+
+  llvm::cl::opt<unsigned> jobs("j", llvm::cl::desc("Number of worker threads (0 uses every hardware thread)"),
+                               llvm::cl::init(0), llvm::cl::cat(toolCategory));
+
+  llvm::cl::list<std::string> pluginArgs("plugin-arg",
+                                         llvm::cl::desc("Argument forwarded to the borrow-check plugin, e.g. --plugin-arg=-engine=cfg"),
+                                         llvm::cl::cat(toolCategory));
+
+  // One diagnostic as it appears in the final report
+  struct ReportEntry
+  {
+    std::string file;
+    unsigned line;
+    unsigned column;
+    DiagnosticsEngine::Level level;
+    std::string message;
+
+    bool operator<(const ReportEntry &other) const
+    {
+      return std::tie(file, line, column, level, message) <
+             std::tie(other.file, other.line, other.column, other.level, other.message);
+    }
+    bool operator==(const ReportEntry &other) const
+    {
+      return std::tie(file, line, column, level, message) ==
+             std::tie(other.file, other.line, other.column, other.level, other.message);
+    }
+  };
+
+  // Diagnostics from every worker. Headers checked by many TUs report the same
+  // diagnostic each time, so entries are deduplicated before printing.
+  class DiagnosticReport
+  {
+    std::mutex mutex;
+    std::vector<ReportEntry> entries;
+    std::atomic<unsigned> checkedTUs{0};
+    unsigned failedWorkers = 0;
+
+  public:
+    void add(ReportEntry entry)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries.push_back(std::move(entry));
+    }
+
+    void addCheckedTU() { checkedTUs++; }
+
+    // A worker's ClangTool could not process one of its files; clang has
+    // already printed which one
+    void addFailedWorker()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      failedWorkers++;
+    }
+
+    // Prints the report and returns the number of errors in it, plus one per
+    // worker that failed to process a file
+    unsigned print(llvm::raw_ostream &os, size_t numFiles)
+    {
+      std::sort(entries.begin(), entries.end());
+      entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+      unsigned errors = 0, warnings = 0;
+      for (const ReportEntry &entry : entries)
+      {
+        const char *level = "note";
+        if (entry.level >= DiagnosticsEngine::Error)
+        {
+          level = "error";
+          errors++;
+        }
+        else if (entry.level == DiagnosticsEngine::Warning)
+        {
+          level = "warning";
+          warnings++;
+        }
+        os << entry.file << ':' << entry.line << ':' << entry.column << ": " << level << ": "
+           << entry.message << '\n';
+      }
+      os << errors << " error(s), " << warnings << " warning(s) in " << checkedTUs << " TU(s) from "
+         << numFiles << " file(s)";
+      if (failedWorkers)
+        os << "; some files could not be processed, see above";
+      os << '\n';
+      return errors + failedWorkers;
+    }
+  };
+
+  // Forwards a worker's diagnostics into the shared report. Remarks, such as
+  // the plugin's "is running" remark, are left out.
+  class ReportingDiagConsumer : public DiagnosticConsumer
+  {
+    DiagnosticReport &report;
+
+  public:
+    explicit ReportingDiagConsumer(DiagnosticReport &r) : report(r) {}
+
+    void HandleDiagnostic(DiagnosticsEngine::Level level, const Diagnostic &info) override
+    {
+      DiagnosticConsumer::HandleDiagnostic(level, info);
+      if (level < DiagnosticsEngine::Note || level == DiagnosticsEngine::Remark)
+        return;
+
+      llvm::SmallString<128> message;
+      info.FormatDiagnostic(message);
+      ReportEntry entry{"<unknown>", 0, 0, level, message.str().str()};
+      if (info.getLocation().isValid() && info.hasSourceManager())
+      {
+        PresumedLoc presumed = info.getSourceManager().getPresumedLoc(info.getLocation());
+        if (presumed.isValid())
+        {
+          entry.file = presumed.getFilename();
+          entry.line = presumed.getLine();
+          entry.column = presumed.getColumn();
+        }
+      }
+      report.add(std::move(entry));
+    }
+  };
+
+  // Creates the registered borrow-check action; nullptr if it was not linked in
+  std::unique_ptr<PluginASTAction> createPluginAction()
+  {
+    for (const FrontendPluginRegistry::entry &plugin : FrontendPluginRegistry::entries())
+    {
+      if (plugin.getName() == "borrow-check")
+        return plugin.instantiate();
+    }
+    return nullptr;
+  }
+
+  // Runs the plugin as the main action after handing it the --plugin-arg values,
+  // just like -plugin borrow-check with -plugin-arg-borrow-check does
+  class PluginRunnerAction : public WrapperFrontendAction
+  {
+    PluginASTAction *plugin;
+    DiagnosticReport &report;
+
+    PluginRunnerAction(PluginASTAction *p, std::unique_ptr<FrontendAction> action, DiagnosticReport &r)
+        : WrapperFrontendAction(std::move(action)), plugin(p), report(r) {}
+
+  public:
+    static std::unique_ptr<FrontendAction> create(DiagnosticReport &report)
+    {
+      std::unique_ptr<PluginASTAction> action = createPluginAction();
+      if (!action)
+        return nullptr;
+      PluginASTAction *plugin = action.get();
+      return std::unique_ptr<FrontendAction>(new PluginRunnerAction(plugin, std::move(action), report));
+    }
+
+  protected:
+    bool BeginInvocation(CompilerInstance &CI) override
+    {
+      std::vector<std::string> args(pluginArgs.begin(), pluginArgs.end());
+      if (!plugin->ParseArgs(CI, args))
+        return false;
+      return WrapperFrontendAction::BeginInvocation(CI);
+    }
+
+    void EndSourceFileAction() override
+    {
+      WrapperFrontendAction::EndSourceFileAction();
+      report.addCheckedTU();
+    }
+  };
+
+  class PluginRunnerFactory : public tooling::FrontendActionFactory
+  {
+    DiagnosticReport &report;
+
+  public:
+    explicit PluginRunnerFactory(DiagnosticReport &r) : report(r) {}
+
+    std::unique_ptr<FrontendAction> create() override
+    {
+      return PluginRunnerAction::create(report);
+    }
+  };
+
+} // namespace
+
+int main(int argc, const char **argv)
+{
+  llvm::InitLLVM initLLVM(argc, argv);
+  auto parser = tooling::CommonOptionsParser::create(argc, argv, toolCategory, llvm::cl::ZeroOrMore);
+  if (!parser)
+  {
+    llvm::errs() << parser.takeError();
+    return 1;
+  }
+  if (!createPluginAction())
+  {
+    llvm::errs() << "borrow-check-tool: the borrow-check plugin is not linked in\n";
+    return 1;
+  }
+
+  const tooling::CompilationDatabase &compilations = parser->getCompilations();
+  std::vector<std::string> files = parser->getSourcePathList();
+  if (files.empty())
+    files = compilations.getAllFiles();
+
+  // Each worker owns one ClangTool for its share of the files. A ClangTool
+  // keeps one FileManager across its runs, so a worker stats each header once.
+  // FileManager is not thread-safe, so workers do not share one.
+  unsigned numWorkers = llvm::hardware_concurrency(jobs).compute_thread_count();
+  numWorkers = std::max(1u, std::min<unsigned>(numWorkers, files.size()));
+  std::vector<std::vector<std::string>> shares(numWorkers);
+  for (size_t i = 0; i < files.size(); ++i)
+    shares[i % numWorkers].push_back(files[i]);
+
+  DiagnosticReport report;
+  auto work = [&](const std::vector<std::string> &share)
+  {
+    // Each worker has its own physical file system, so compile commands
+    // changing the working directory do not race on the process cwd
+    tooling::ClangTool tool(compilations, share, std::make_shared<PCHContainerOperations>(),
+                            llvm::vfs::createPhysicalFileSystem());
+    ReportingDiagConsumer consumer(report);
+    tool.setDiagnosticConsumer(&consumer);
+    PluginRunnerFactory factory(report);
+    if (tool.run(&factory) != 0)
+      report.addFailedWorker();
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < numWorkers; ++i)
+    workers.emplace_back(work, std::cref(shares[i]));
+  work(shares[0]);
+  for (std::thread &worker : workers)
+    worker.join();
+
+  return report.print(llvm::outs(), files.size()) ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+// contention_bench.cpp
+// Measures immutable borrow throughput when many threads borrow one shared
+// Unique. Build with OWNERSHIP_THREAD_SAFE so the borrow counter is atomic.
+// Usage: contention_bench [threads] [borrows-per-thread]
+
+#include "ownership.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Takes and drops an immutable borrow of shared iterations times
+static void readLoop(const Unique<long> &shared, long iterations, long *result)
+{
+    long sum = 0;
+    for (long i = 0; i < iterations; ++i)
+    {
+        Borrowed<long> b = shared.borrow();
+        sum += *b;
+    }
+    *result = sum;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned threads = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+    long iterations = argc > 2 ? std::atol(argv[2]) : 1000000;
+    if (threads == 0 || iterations <= 0)
+    {
+        std::fprintf(stderr, "usage: %s [threads] [borrows-per-thread]\n", argv[0]);
+        return 1;
+    }
+
+    const Unique<long> shared(new long(1));
+    std::vector<long> sums(threads, 0);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.emplace_back(readLoop, std::cref(shared), iterations, &sums[t]);
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    long total = 0;
+    for (long sum : sums)
+        total += sum;
+    if (total != static_cast<long>(threads) * iterations)
+    {
+        std::fprintf(stderr, "unexpected sum %ld\n", total);
+        return 1;
+    }
+
+    std::printf("threads=%u borrows=%ld ns/borrow=%.2f (wall time / borrows per thread)\n",
+                threads, total, elapsed / iterations);
+    return 0;
+}
@@ -0,0 +1,43 @@
+// gen_tu.cpp
+// Generates a synthetic translation unit for timing the borrow checker plugin.
+// Usage: gen_tu <uniques> <depth> [functions] > out.cpp
+//
+// The output declares <uniques> tracked Unique globals and [functions] functions
+// (default 1), each nesting <depth> compound statements that take a borrow of a
+// global. Plugin time should grow with the number of borrows, not uniques * depth.
+
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char **argv)
+{
+    if (argc != 3 && argc != 4)
+    {
+        std::fprintf(stderr, "usage: %s <uniques> <depth> [functions]\n", argv[0]);
+        return 1;
+    }
+    int globals = std::atoi(argv[1]);
+    int depth = std::atoi(argv[2]);
+    int functions = argc == 4 ? std::atoi(argv[3]) : 1;
+    if (globals <= 0 || depth < 0 || functions <= 0)
+    {
+        std::fprintf(stderr, "uniques and functions must be positive and depth non-negative\n");
+        return 1;
+    }
+
+    std::printf("#include \"ownership.h\"\n\n");
+    for (int i = 0; i < globals; ++i)
+        std::printf("Unique<int> g%d(new int(%d));\n", i, i);
+
+    // Consecutive functions borrow different globals so every Unique gets used
+    for (int f = 0; f < functions; ++f)
+    {
+        std::printf("\nvoid nested%d()\n{\n", f);
+        for (int d = 0; d < depth; ++d)
+            std::printf("%*s{ Borrowed<int> b%d = g%d.borrow();\n", (d + 1) * 4, "", d, (f * depth + d) % globals);
+        for (int d = depth - 1; d >= 0; --d)
+            std::printf("%*s}\n", (d + 1) * 4, "");
+        std::printf("}\n");
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+// ownership_bench.cpp
+// Google Benchmark microbenchmarks for the ownership.h primitives. The build
+// compiles it once with borrow tracking and once with OWNERSHIP_UNCHECKED, so
+// the two binaries show what the runtime checks cost.
+
+#include "ownership.h"
+
+#include <benchmark/benchmark.h>
+
+#include <utility>
+#include <vector>
+
+// Takes and drops an immutable borrow
+static void BM_BorrowRelease(benchmark::State &state)
+{
+    Unique<int> data(new int(1));
+    for (auto _ : state)
+    {
+        Borrowed<int> b = data.borrow();
+        benchmark::DoNotOptimize(*b);
+    }
+}
+BENCHMARK(BM_BorrowRelease);
+
+// Takes and drops a mutable borrow
+static void BM_BorrowMutRelease(benchmark::State &state)
+{
+    Unique<int> data(new int(1));
+    for (auto _ : state)
+    {
+        BorrowedMut<int> b = data.borrow_mut();
+        benchmark::DoNotOptimize(++*b);
+    }
+}
+BENCHMARK(BM_BorrowMutRelease);
+
+// The non-throwing borrow, including its BorrowResult wrapper
+static void BM_TryBorrow(benchmark::State &state)
+{
+    Unique<int> data(new int(1));
+    for (auto _ : state)
+    {
+        auto result = data.try_borrow();
+        benchmark::DoNotOptimize(**result);
+    }
+}
+BENCHMARK(BM_TryBorrow);
+
+// Moves ownership back and forth between two Uniques
+static void BM_UniqueMove(benchmark::State &state)
+{
+    Unique<int> a(new int(1));
+    Unique<int> b(nullptr);
+    for (auto _ : state)
+    {
+        b = std::move(a);
+        a = std::move(b);
+        benchmark::DoNotOptimize(a);
+    }
+}
+BENCHMARK(BM_UniqueMove);
+
+// Grows a vector of borrows from empty, so every reallocation moves them
+static void BM_VectorOfBorrowedGrowth(benchmark::State &state)
+{
+    Unique<int> data(new int(1));
+    const int count = static_cast<int>(state.range(0));
+    for (auto _ : state)
+    {
+        std::vector<Borrowed<int>> borrows;
+        for (int i = 0; i < count; ++i)
+            borrows.push_back(data.borrow());
+        benchmark::DoNotOptimize(borrows.data());
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_VectorOfBorrowedGrowth)->Range(8, 4096);
+
+struct Point
+{
+    int x;
+    int y;
+};
+
+// operator-> on the owner, which checks for live borrows
+static void BM_CheckedArrow(benchmark::State &state)
+{
+    Unique<Point> point(new Point{1, 2});
+    for (auto _ : state)
+    {
+        point->x += point->y;
+        benchmark::DoNotOptimize(point->x);
+    }
+}
+BENCHMARK(BM_CheckedArrow);
+
+// The same access through a raw pointer, as the baseline
+static void BM_RawArrow(benchmark::State &state)
+{
+    Point *point = new Point{1, 2};
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(point);
+        point->x += point->y;
+        benchmark::DoNotOptimize(point->x);
+    }
+    delete point;
+}
+BENCHMARK(BM_RawArrow);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,135 @@
+// Compile-only checks of ownership.h in constant expressions (C++20).
+// Nothing here runs: every check is a static_assert, so building this file is
+// the test.
+//
+// Checked builds need a compiler that lets constant evaluation write mutable
+// members of objects it created. GCC 12 rejects that, so the build compiles this
+// file with OWNERSHIP_UNCHECKED under GCC, which keeps only the checks that do
+// not depend on conflict detection.
+#include "ownership.h"
+#include <array>
+
+#ifndef __cpp_constexpr_dynamic_alloc
+#error "constexpr_test.cpp needs C++20 (constexpr new and delete)"
+#endif
+
+// An immutable borrow reads through to the owned value
+constexpr int readThroughBorrow()
+{
+    Unique<int> value(new int(42));
+    Borrowed<int> view = value.borrow();
+    return *view;
+}
+static_assert(readThroughBorrow() == 42);
+
+// A mutable borrow writes through, and ends at scope exit
+constexpr int writeThroughBorrowMut()
+{
+    Unique<int> value(new int(1));
+    {
+        BorrowedMut<int> edit = value.borrow_mut();
+        *edit = 7;
+    }
+    Borrowed<int> view = value.borrow();
+    return *view;
+}
+static_assert(writeThroughBorrowMut() == 7);
+
+// Moving a Unique transfers ownership and leaves the source empty
+constexpr bool moveTransfersOwnership()
+{
+    Unique<int> from(new int(3));
+    Unique<int> to(std::move(from));
+    return !from && to && *to.borrow() == 3;
+}
+static_assert(moveTransfersOwnership());
+
+// Moving a borrow transfers it without touching the owner's count
+constexpr int moveBorrow()
+{
+    Unique<int> value(new int(5));
+    Borrowed<int> first = value.borrow();
+    Borrowed<int> second(std::move(first));
+    return *second;
+}
+static_assert(moveBorrow() == 5);
+
+// The README table: fill through a mutable borrow, then read through a shared one
+constexpr std::array<int, 4> squares()
+{
+    Unique<int[]> values(new int[4], 4);
+    {
+        BorrowedMut<int[]> all = values.borrow_mut();
+        for (std::size_t i = 0; i < all.size(); ++i)
+            all[i] = int(i * i);
+    }
+    std::array<int, 4> table{};
+    Borrowed<int[]> view = values.borrow();
+    for (std::size_t i = 0; i < table.size(); ++i)
+        table[i] = view[i];
+    return table;
+}
+static_assert(squares()[3] == 9);
+
+#ifndef OWNERSHIP_UNCHECKED
+// Conflicts are seen by the constant evaluator; a throwing borrow() here would
+// fail to compile, so probe them with try_borrow
+constexpr bool sharedBlocksMutable()
+{
+    Unique<int> value(new int(0));
+    Borrowed<int> view = value.borrow();
+    return !value.try_borrow_mut() && value.try_borrow();
+}
+static_assert(sharedBlocksMutable());
+
+constexpr bool mutableBlocksShared()
+{
+    Unique<int> value(new int(0));
+    BorrowedMut<int> edit = value.borrow_mut();
+    return !value.try_borrow() && !value.try_borrow_mut();
+}
+static_assert(mutableBlocksShared());
+
+// A refused borrow reports which borrow it conflicts with
+constexpr bool conflictCodes()
+{
+    using Code = BorrowError::ErrorCode;
+    Unique<int> shared(new int(0));
+    Borrowed<int> view = shared.borrow();
+    Unique<int> exclusive(new int(0));
+    BorrowedMut<int> edit = exclusive.borrow_mut();
+    return shared.try_borrow_mut().error() == Code::MutableBorrowOfImmutablyBorrowed &&
+           exclusive.try_borrow_mut().error() == Code::MutableBorrowOfMutablyBorrowed &&
+           exclusive.try_borrow().error() == Code::ImmutableBorrowOfMutablyBorrowed;
+}
+static_assert(conflictCodes());
+
+constexpr bool arrayConflictCodes()
+{
+    using Code = BorrowError::ErrorCode;
+    Unique<int[]> values(new int[2], 2);
+    BorrowedMut<int[]> all = values.borrow_mut();
+    return values.try_borrow_mut().error() == Code::MutableBorrowOfMutablyBorrowed &&
+           values.try_borrow().error() == Code::ImmutableBorrowOfMutablyBorrowed;
+}
+static_assert(arrayConflictCodes());
+
+constexpr bool borrowEndsAtScopeExit()
+{
+    Unique<int> value(new int(0));
+    {
+        BorrowedMut<int> edit = value.borrow_mut();
+    }
+    return bool(value.try_borrow_mut());
+}
+static_assert(borrowEndsAtScopeExit());
+
+constexpr bool movedBorrowStillBlocks()
+{
+    Unique<int> value(new int(0));
+    BorrowedMut<int> first = value.borrow_mut();
+    BorrowedMut<int> second(std::move(first));
+    return !first && !value.try_borrow();
+}
+static_assert(movedBorrowStillBlocks());
+#endif
@@ -1,8 +1,150 @@
 // ownership.h
 // This file defines a simple ownership model in C++ that mimics Rust's borrow checker.
+// Unique<T, Deleter> owns a single object and Unique<T[], Deleter> owns an array;
+// the deleter defaults to DefaultDeleter, which uses delete or delete[].
+//
+// Defining OWNERSHIP_UNCHECKED before including this header removes all runtime
+// borrow tracking: Unique<T> is exactly the size of a T*, Borrowed<T> and
+// BorrowedMut<T> are bare pointers, and accessors compile without checks. Use it
+// for builds that already pass the BorrowCheckPlugin, which is then the guarantee.
+//
+// Defining OWNERSHIP_THREAD_SAFE instead makes borrow tracking safe when one Unique
+// is borrowed from several threads. The reader count and the mutable flag share
+// one atomic word, so every acquire and release is a single atomic operation.
+//
+// Defining OWNERSHIP_NOEXCEPT_DESTRUCTOR makes ~Unique noexcept. Destroying a
+// borrowed Unique then calls the BorrowViolationHandler instead of throwing.
+//
+// Defining OWNERSHIP_TRACE_BORROWS records every borrow acquire and release in a
+// small per-thread ring buffer, together with the file and line that took the
+// borrow. The buffer is printed to stderr when a borrow error is raised. It does
+// nothing together with OWNERSHIP_UNCHECKED.
+//
+// Compiled as C++20, Unique and its borrows are constexpr: a table built in a
+// constant expression is borrow checked by the compiler. GCC 12 cannot constant
+// evaluate the checked borrow counts, so there only OWNERSHIP_UNCHECKED builds
+// are constexpr. See OWNERSHIP_CONSTEXPR and constexpr_test.cpp.
 
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#ifdef OWNERSHIP_THREAD_SAFE
+#include <atomic>
+#endif
+
+// OWNERSHIP_CONSTEXPR marks what can run in a constant expression once new and
+// delete are allowed there (C++20). A borrow conflict during constant evaluation
+// reaches a throw, so it becomes a compile error and costs nothing at runtime.
+// Atomic borrow counts cannot be constant evaluated, so OWNERSHIP_THREAD_SAFE
+// turns it off.
+#if defined(__cpp_constexpr_dynamic_alloc) && !defined(OWNERSHIP_THREAD_SAFE)
+#define OWNERSHIP_CONSTEXPR constexpr
+#else
+#define OWNERSHIP_CONSTEXPR
+#endif
+
+#if defined(OWNERSHIP_TRACE_BORROWS) && !defined(OWNERSHIP_UNCHECKED)
+// Borrow provenance for debug and canary builds. Each thread keeps its last
+// OWNERSHIP_TRACE_RING_SIZE acquire and release events, so recording one is a
+// thread-local store with no synchronization. Every borrow method takes the
+// source location of its caller as a defaulted argument; a release records
+// the location where its borrow was taken.
+#ifndef OWNERSHIP_TRACE_RING_SIZE
+#define OWNERSHIP_TRACE_RING_SIZE 256
+#endif
+
+namespace ownership_trace
+{
+    enum class EventKind : std::uintptr_t
+    {
+        AcquireImmutable,
+        ReleaseImmutable,
+        AcquireMutable,
+        ReleaseMutable
+    };
+
+    // A source location. As a default argument, current() is evaluated at the
+    // call of the function that declares it, like std::source_location.
+    struct Site
+    {
+        const char *file = nullptr; // Null if unknown
+        unsigned line = 0;
+
+        static constexpr Site current(const char *file = __builtin_FILE(), unsigned line = __builtin_LINE()) noexcept
+        {
+            return {file, line};
+        }
+    };
+
+    // Trackers are at least 4-byte aligned, so the kind fits in the low bits
+    // of the owner address
+    struct Event
+    {
+        std::uintptr_t ownerAndKind;
+        Site site;
+
+        const void *owner() const { return reinterpret_cast<const void *>(ownerAndKind & ~std::uintptr_t(3)); }
+        EventKind kind() const { return static_cast<EventKind>(ownerAndKind & 3); }
+    };
+
+    constexpr std::size_t RingSize = OWNERSHIP_TRACE_RING_SIZE;
+    static_assert(RingSize != 0 && (RingSize & (RingSize - 1)) == 0, "OWNERSHIP_TRACE_RING_SIZE must be a power of two");
+
+    struct Ring
+    {
+        Event events[RingSize] = {}; // Constant-initialized, so access needs no thread_local guard
+        std::size_t next = 0; // Events recorded so far; the oldest is overwritten once it wraps
+    };
+
+    inline thread_local Ring ring;
+
+    inline void record(const void *owner, EventKind kind, Site site) noexcept
+    {
+        Ring &r = ring;
+        r.events[r.next++ & (RingSize - 1)] = {reinterpret_cast<std::uintptr_t>(owner) | static_cast<std::uintptr_t>(kind), site};
+    }
+
+    // Prints the calling thread's events, oldest first
+    inline void dump(std::FILE *out = stderr)
+    {
+        static const char *const names[] = {"acquire immutable", "release immutable", "acquire mutable", "release mutable"};
+        const Ring &r = ring;
+        std::size_t count = r.next < RingSize ? r.next : RingSize;
+        std::fprintf(out, "Last %zu borrow events on this thread, oldest first:\n", count);
+        for (std::size_t i = r.next - count; i != r.next; ++i)
+        {
+            const Event &event = r.events[i & (RingSize - 1)];
+            std::fprintf(out, "  #%zu %-17s owner %p at %s:%u\n", i, names[static_cast<std::size_t>(event.kind())],
+                         event.owner(), event.site.file ? event.site.file : "<unknown>", event.site.line);
+        }
+    }
+}
+
+#if defined(__cpp_lib_is_constant_evaluated)
+// Borrows taken during constant evaluation are not traced
+#define OWNERSHIP_TRACE_EVENT(kind) \
+    (std::is_constant_evaluated() ? (void)0 : ownership_trace::record(this, ownership_trace::EventKind::kind, site))
+#else
+#define OWNERSHIP_TRACE_EVENT(kind) ownership_trace::record(this, ownership_trace::EventKind::kind, site)
+#endif
+// Borrow methods take their caller's location only in tracing builds
+#define OWNERSHIP_TRACE_ONLY(...) __VA_ARGS__
+#else
+#define OWNERSHIP_TRACE_EVENT(kind) ((void)0)
+#define OWNERSHIP_TRACE_ONLY(...)
+#endif
+#define OWNERSHIP_SITE_PARAM OWNERSHIP_TRACE_ONLY(ownership_trace::Site site = ownership_trace::Site::current())
+#define OWNERSHIP_SITE_PARAM_NEXT OWNERSHIP_TRACE_ONLY(, ownership_trace::Site site = ownership_trace::Site::current())
 
 // Custom error class for borrow checker violations
 class BorrowError : public std::runtime_error
@@ -28,273 +170,752 @@ private:
 
 public:
     BorrowError(const std::string &message, ErrorCode code)
-        : std::runtime_error(message), code_(code) {}
+        : std::runtime_error(message), code_(code)
+    {
+#if defined(OWNERSHIP_TRACE_BORROWS) && !defined(OWNERSHIP_UNCHECKED)
+        std::fprintf(stderr, "BorrowError: %s\n", message.c_str());
+        ownership_trace::dump();
+#endif
+    }
 
     ErrorCode code() const { return code_; }
 };
 
+// Called instead of throwing where throwing is not allowed, such as a noexcept
+// ~Unique. The default handler prints the message and aborts.
+using BorrowViolationHandler = void (*)(BorrowError::ErrorCode code, const char *message);
+
+inline void abortOnBorrowViolation(BorrowError::ErrorCode, const char *message)
+{
+    std::fprintf(stderr, "BorrowError: %s\n", message);
+    std::abort();
+}
+
+inline BorrowViolationHandler borrowViolationHandler = abortOnBorrowViolation;
+
+// Installs a new violation handler and returns the previous one. Not synchronized;
+// install handlers during startup, before other threads use Unique.
+inline BorrowViolationHandler setBorrowViolationHandler(BorrowViolationHandler handler)
+{
+    BorrowViolationHandler previous = borrowViolationHandler;
+    borrowViolationHandler = handler ? handler : abortOnBorrowViolation;
+    return previous;
+}
+
 // Forward declarations
 template <typename T>
+struct DefaultDeleter;
+template <typename T>
 class Borrowed;
 template <typename T>
 class BorrowedMut;
-template <typename T>
+template <typename T, typename Deleter = DefaultDeleter<T>>
 class Unique;
 
-// Unique - Enforce ownership semantics (no copies, moves only).
-template <typename T>
-class Unique
+// Tag for constructing a borrow whose count was already acquired
+struct AdoptBorrow
 {
-    T *data;
+    explicit AdoptBorrow() = default;
+};
+inline constexpr AdoptBorrow adopt_borrow{};
+
+// BorrowResult - Outcome of a non-throwing borrow attempt. Holds either the
+// borrow or the error code that the throwing version would have raised.
+template <typename B>
+class BorrowResult
+{
+    std::optional<B> value_;
+    BorrowError::ErrorCode error_{};
+
+public:
+    OWNERSHIP_CONSTEXPR BorrowResult(B &&value) noexcept : value_(std::move(value)) {}
+    OWNERSHIP_CONSTEXPR BorrowResult(BorrowError::ErrorCode error) noexcept : error_(error) {}
+
+    OWNERSHIP_CONSTEXPR bool ok() const { return value_.has_value(); }
+    OWNERSHIP_CONSTEXPR explicit operator bool() const { return ok(); }
+    OWNERSHIP_CONSTEXPR BorrowError::ErrorCode error() const { return error_; } // Only meaningful when !ok()
+
+    // Access the borrow; only valid when ok()
+    OWNERSHIP_CONSTEXPR B &value() { return *value_; }
+    OWNERSHIP_CONSTEXPR B &operator*() { return *value_; }
+    OWNERSHIP_CONSTEXPR B *operator->() { return &*value_; }
+    OWNERSHIP_CONSTEXPR B take() { return std::move(*value_); }
+};
+
+// BorrowTracker - Borrow state shared by every owner. Borrows hold a pointer to it.
+// In OWNERSHIP_UNCHECKED builds it is empty and every check compiles away.
+class BorrowTracker
+{
+#if defined(OWNERSHIP_THREAD_SAFE)
+    static constexpr unsigned MutableBit = 1u << 31; // Set while mutably borrowed
+    static constexpr unsigned CountMask = ~MutableBit;
+    mutable std::atomic<unsigned> state{0};          // Borrow count (readers or mutable parts) in the low bits
+#elif !defined(OWNERSHIP_UNCHECKED)
     mutable int immutable_borrows = 0;     // Track immutable borrow count
-    mutable bool mutable_borrowed = false; // Track mutable borrow state
+    mutable unsigned mutable_parts = 0;    // Live parts of the mutable borrow, 0 if none
+#endif
 
 public:
-    Unique(T *ptr) : data(ptr) {}
-    ~Unique() noexcept(false)
+#if defined(OWNERSHIP_UNCHECKED)
+    OWNERSHIP_CONSTEXPR bool isBorrowed() const { return false; }
+    OWNERSHIP_CONSTEXPR bool isMutablyBorrowed() const { return false; }
+
+    OWNERSHIP_CONSTEXPR bool tryAcquireImmutableBorrow() const { return true; }
+    OWNERSHIP_CONSTEXPR bool tryAcquireMutableBorrow(unsigned = 1) const { return true; }
+    OWNERSHIP_CONSTEXPR void releaseBorrowImmutable() const {}
+    OWNERSHIP_CONSTEXPR void releaseMutableBorrow() const {}
+#elif defined(OWNERSHIP_THREAD_SAFE)
+    // Acquires synchronize with the matching release, so a writer sees every
+    // reader's accesses and readers see the previous writer's changes
+    bool isBorrowed() const { return state.load(std::memory_order_acquire) != 0; }
+    bool isMutablyBorrowed() const { return (state.load(std::memory_order_acquire) & MutableBit) != 0; }
+
+    bool tryAcquireImmutableBorrow(OWNERSHIP_SITE_PARAM) const
     {
-        // Ensure there are no active borrows when destroying
-        if (immutable_borrows > 0 || mutable_borrowed)
+        unsigned current = state.load(std::memory_order_relaxed);
+        do
         {
-            throw BorrowError("Cannot destroy Unique while it is borrowed", BorrowError::ErrorCode::DestroyWithActiveBorrows);
-        }
-        delete data;
+            if (current & MutableBit)
+                return false;
+        } while (!state.compare_exchange_weak(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed));
+        OWNERSHIP_TRACE_EVENT(AcquireImmutable);
+        return true;
     }
 
-    // Disallow copying (enforce move semantics)
-    // These operators are deleted to prevent copying
-    Unique(const Unique &) = delete;
-    Unique &operator=(const Unique &) = delete;
-
-    // Allow moving
-    // This constructor transfers ownership of the resource from 'other' to 'this'.
-    Unique(Unique &&other) noexcept(false) : data(other.data),
-                                             immutable_borrows(other.immutable_borrows),
-                                             mutable_borrowed(other.mutable_borrowed)
-    {
-        // Check if the object being moved from has active borrows
-        if (immutable_borrows > 0 || mutable_borrowed)
+    bool tryAcquireMutableBorrow(unsigned parts = 1 OWNERSHIP_SITE_PARAM_NEXT) const
+    {
+        unsigned expected = 0;
+        if (!state.compare_exchange_strong(expected, MutableBit | parts, std::memory_order_acquire, std::memory_order_relaxed))
+            return false;
+        OWNERSHIP_TRACE_EVENT(AcquireMutable);
+        return true;
+    }
+
+    void releaseBorrowImmutable(OWNERSHIP_SITE_PARAM) const
+    {
+        unsigned previous = state.fetch_sub(1, std::memory_order_release);
+        if ((previous & CountMask) == 0)
         {
-            throw BorrowError("Cannot move Unique while it is borrowed", BorrowError::ErrorCode::MoveWithActiveBorrows);
+            state.fetch_add(1, std::memory_order_relaxed); // Undo the underflow
+            throw BorrowError("Attempting to release non-existent immutable borrow", BorrowError::ErrorCode::ReleaseNonExistentImmutableBorrow);
         }
-        other.data = nullptr;
-        other.immutable_borrows = 0;
-        other.mutable_borrowed = false;
+        OWNERSHIP_TRACE_EVENT(ReleaseImmutable);
     }
 
-    // This operator transfers ownership of the resource from 'other' to 'this'.
-    Unique &operator=(Unique &&other) noexcept(false)
+    // The last part to be released clears the mutable bit
+    void releaseMutableBorrow(OWNERSHIP_SITE_PARAM) const
     {
-        if (this != &other)
+        unsigned current = state.load(std::memory_order_relaxed);
+        unsigned next;
+        do
         {
-            // Check if the destination object has active borrows
-            if (immutable_borrows > 0 || mutable_borrowed)
+            if (!(current & MutableBit) || (current & CountMask) == 0)
             {
-                throw BorrowError("Cannot move into Unique while it is borrowed", BorrowError::ErrorCode::MoveIntoWithActiveBorrows);
+                throw BorrowError("Attempting to release non-existent mutable borrow", BorrowError::ErrorCode::ReleaseNonExistentMutableBorrow);
             }
-
-            // Check if the source object has active borrows
-            if (other.immutable_borrows > 0 || other.mutable_borrowed)
-            {
-                throw BorrowError("Cannot move from Unique while it is borrowed", BorrowError::ErrorCode::MoveFromWithActiveBorrows);
-            }
-
-            delete data;          // Clean up current resource
-            data = other.data;    // Transfer ownership
-            other.data = nullptr; // Nullify the moved-from object
-
-            // Transfer borrow state (should be zero at this point)
-            immutable_borrows = other.immutable_borrows;
-            mutable_borrowed = other.mutable_borrowed;
-            other.immutable_borrows = 0;
-            other.mutable_borrowed = false;
-        }
-        return *this;
+            next = (current & CountMask) == 1 ? 0 : current - 1;
+        } while (!state.compare_exchange_weak(current, next, std::memory_order_release, std::memory_order_relaxed));
+        OWNERSHIP_TRACE_EVENT(ReleaseMutable);
     }
+#else
+    OWNERSHIP_CONSTEXPR bool isBorrowed() const { return immutable_borrows > 0 || mutable_parts > 0; }
+    OWNERSHIP_CONSTEXPR bool isMutablyBorrowed() const { return mutable_parts > 0; }
 
     // Borrow tracking methods
-    void acquireImmutableBorrow() const
+    OWNERSHIP_CONSTEXPR bool tryAcquireImmutableBorrow(OWNERSHIP_SITE_PARAM) const
     {
-        if (mutable_borrowed)
-        {
-            throw BorrowError("Cannot immutably borrow: already mutably borrowed", BorrowError::ErrorCode::MutableBorrowOfMutablyBorrowed);
-        }
+        if (mutable_parts > 0)
+            return false;
         immutable_borrows++;
+        OWNERSHIP_TRACE_EVENT(AcquireImmutable);
+        return true;
     }
 
-    void releaseBorrowImmutable() const
+    OWNERSHIP_CONSTEXPR bool tryAcquireMutableBorrow(unsigned parts = 1 OWNERSHIP_SITE_PARAM_NEXT) const
+    {
+        if (immutable_borrows > 0 || mutable_parts > 0)
+            return false;
+        mutable_parts = parts;
+        OWNERSHIP_TRACE_EVENT(AcquireMutable);
+        return true;
+    }
+
+    OWNERSHIP_CONSTEXPR void releaseBorrowImmutable(OWNERSHIP_SITE_PARAM) const
     {
         if (immutable_borrows <= 0)
         {
             throw BorrowError("Attempting to release non-existent immutable borrow", BorrowError::ErrorCode::ReleaseNonExistentImmutableBorrow);
         }
         immutable_borrows--;
+        OWNERSHIP_TRACE_EVENT(ReleaseImmutable);
     }
 
-    void acquireMutableBorrow() const
+    OWNERSHIP_CONSTEXPR void releaseMutableBorrow(OWNERSHIP_SITE_PARAM) const
     {
-        if (immutable_borrows > 0 || mutable_borrowed)
+        if (mutable_parts == 0)
         {
-            throw BorrowError("Cannot mutably borrow: already borrowed", BorrowError::ErrorCode::MutableBorrowOfImmutablyBorrowed);
+            throw BorrowError("Attempting to release non-existent mutable borrow", BorrowError::ErrorCode::ReleaseNonExistentMutableBorrow);
         }
-        mutable_borrowed = true;
+        mutable_parts--;
+        OWNERSHIP_TRACE_EVENT(ReleaseMutable);
     }
+#endif
 
-    void releaseMutableBorrow() const
+    // Why a mutable borrow was refused. Under OWNERSHIP_THREAD_SAFE this reads the
+    // state after the refusal, which another thread may have changed since.
+    OWNERSHIP_CONSTEXPR BorrowError::ErrorCode mutableBorrowConflict() const
     {
-        if (!mutable_borrowed)
-        {
-            throw BorrowError("Attempting to release non-existent mutable borrow", BorrowError::ErrorCode::ReleaseNonExistentMutableBorrow);
-        }
-        mutable_borrowed = false;
+        return isMutablyBorrowed() ? BorrowError::ErrorCode::MutableBorrowOfMutablyBorrowed
+                                   : BorrowError::ErrorCode::MutableBorrowOfImmutablyBorrowed;
     }
 
-    // Borrow methods
-    Borrowed<T> borrow() const
+    OWNERSHIP_CONSTEXPR void acquireImmutableBorrow(OWNERSHIP_SITE_PARAM) const
     {
-        return Borrowed<T>(this, data);
+        if (!tryAcquireImmutableBorrow(OWNERSHIP_TRACE_ONLY(site)))
+        {
+            throw BorrowError("Cannot immutably borrow: already mutably borrowed", BorrowError::ErrorCode::ImmutableBorrowOfMutablyBorrowed);
+        }
     }
 
-    BorrowedMut<T> borrow_mut()
+    // A mutable borrow may be split into parts over disjoint pieces of the owner.
+    // Each part releases separately, and the owner is free again after the last.
+    OWNERSHIP_CONSTEXPR void acquireMutableBorrow(unsigned parts = 1 OWNERSHIP_SITE_PARAM_NEXT) const
     {
-        return BorrowedMut<T>(this, data);
+        if (!tryAcquireMutableBorrow(parts OWNERSHIP_TRACE_ONLY(, site)))
+        {
+            BorrowError::ErrorCode conflict = mutableBorrowConflict();
+            throw BorrowError(conflict == BorrowError::ErrorCode::MutableBorrowOfMutablyBorrowed
+                                  ? "Cannot mutably borrow: already mutably borrowed"
+                                  : "Cannot mutably borrow: already immutably borrowed",
+                              conflict);
+        }
     }
 
-    // Accessors
-    T *operator->()
+protected:
+    // Direct access through the owner needs no borrows (mutable access)
+    OWNERSHIP_CONSTEXPR void checkAccess() const
     {
-        if (immutable_borrows > 0 || mutable_borrowed)
+        if (isBorrowed())
         {
             throw BorrowError("Cannot access directly while borrowed", BorrowError::ErrorCode::AccessWhileBorrowed);
         }
-        return data;
     }
 
-    const T *operator->() const
+    // or no mutable borrow (const access)
+    OWNERSHIP_CONSTEXPR void checkConstAccess() const
     {
-        if (mutable_borrowed)
+        if (isMutablyBorrowed())
         {
             throw BorrowError("Cannot access directly while mutably borrowed", BorrowError::ErrorCode::AccessWhileMutablyBorrowed);
         }
-        return data;
     }
+};
+
+#if defined(OWNERSHIP_TRACE_BORROWS) && !defined(OWNERSHIP_UNCHECKED)
+static_assert(alignof(BorrowTracker) >= 4, "trace events pack their kind into the tracker address");
+#endif
+
+// DefaultDeleter - Frees what Unique owns with delete, or delete[] for arrays.
+// It is stateless, so a Unique using it is no larger than one without a deleter.
+template <typename T>
+struct DefaultDeleter
+{
+    OWNERSHIP_CONSTEXPR void operator()(T *ptr) const { delete ptr; }
+};
 
-    T &operator*()
+template <typename T>
+struct DefaultDeleter<T[]>
+{
+    OWNERSHIP_CONSTEXPR void operator()(T *ptr) const { delete[] ptr; }
+};
+
+namespace ownership_detail
+{
+    // Holds a deleter as an empty base when it has no state, as a member otherwise
+    template <typename D, bool = std::is_empty<D>::value && !std::is_final<D>::value>
+    class DeleterStorage : private D
+    {
+    public:
+        DeleterStorage() = default;
+        OWNERSHIP_CONSTEXPR explicit DeleterStorage(D deleter) : D(std::move(deleter)) {}
+        OWNERSHIP_CONSTEXPR D &deleter() { return *this; }
+        OWNERSHIP_CONSTEXPR const D &deleter() const { return *this; }
+    };
+
+    template <typename D>
+    class DeleterStorage<D, false>
     {
-        if (immutable_borrows > 0 || mutable_borrowed)
+        D deleter_;
+
+    public:
+        DeleterStorage() = default;
+        OWNERSHIP_CONSTEXPR explicit DeleterStorage(D deleter) : deleter_(std::move(deleter)) {}
+        OWNERSHIP_CONSTEXPR D &deleter() { return deleter_; }
+        OWNERSHIP_CONSTEXPR const D &deleter() const { return deleter_; }
+    };
+
+    // UniqueStorage - Owns a T* and its deleter. The destruction and move rules
+    // shared by Unique<T> and Unique<T[]> live here.
+    template <typename T, typename Deleter>
+    class UniqueStorage : public BorrowTracker, private DeleterStorage<Deleter>
+    {
+    protected:
+        T *data;
+
+        OWNERSHIP_CONSTEXPR UniqueStorage(T *ptr, Deleter deleter) : DeleterStorage<Deleter>(std::move(deleter)), data(ptr) {}
+
+        OWNERSHIP_CONSTEXPR void destroy()
         {
-            throw BorrowError("Cannot access directly while borrowed", BorrowError::ErrorCode::AccessWhileBorrowed);
+            if (data)
+                this->deleter()(data);
         }
-        return *data;
+
+    public:
+#ifdef OWNERSHIP_NOEXCEPT_DESTRUCTOR
+        OWNERSHIP_CONSTEXPR ~UniqueStorage() noexcept
+        {
+            // Report active borrows instead of throwing. If the handler returns, the
+            // resource is leaked rather than freed under the remaining borrows.
+            if (isBorrowed())
+            {
+#if defined(OWNERSHIP_TRACE_BORROWS) && !defined(OWNERSHIP_UNCHECKED)
+                ownership_trace::dump();
+#endif
+                borrowViolationHandler(BorrowError::ErrorCode::DestroyWithActiveBorrows, "Cannot destroy Unique while it is borrowed");
+                return;
+            }
+            destroy();
+        }
+#else
+        OWNERSHIP_CONSTEXPR ~UniqueStorage() noexcept(false)
+        {
+            // Ensure there are no active borrows when destroying
+            if (isBorrowed())
+            {
+                throw BorrowError("Cannot destroy Unique while it is borrowed", BorrowError::ErrorCode::DestroyWithActiveBorrows);
+            }
+            destroy();
+        }
+#endif
+
+        // Disallow copying (enforce move semantics)
+        // These operators are deleted to prevent copying
+        UniqueStorage(const UniqueStorage &) = delete;
+        UniqueStorage &operator=(const UniqueStorage &) = delete;
+
+        // Allow moving
+        // This constructor transfers ownership of the resource from 'other' to 'this'.
+        OWNERSHIP_CONSTEXPR UniqueStorage(UniqueStorage &&other) noexcept(false)
+            : DeleterStorage<Deleter>(std::move(other.deleter())), data(other.data)
+        {
+            // Check if the object being moved from has active borrows
+            if (other.isBorrowed())
+            {
+                throw BorrowError("Cannot move Unique while it is borrowed", BorrowError::ErrorCode::MoveWithActiveBorrows);
+            }
+            other.data = nullptr;
+        }
+
+        // This operator transfers ownership of the resource from 'other' to 'this'.
+        OWNERSHIP_CONSTEXPR UniqueStorage &operator=(UniqueStorage &&other) noexcept(false)
+        {
+            if (this != &other)
+            {
+                // Check if the destination object has active borrows
+                if (isBorrowed())
+                {
+                    throw BorrowError("Cannot move into Unique while it is borrowed", BorrowError::ErrorCode::MoveIntoWithActiveBorrows);
+                }
+
+                // Check if the source object has active borrows
+                if (other.isBorrowed())
+                {
+                    throw BorrowError("Cannot move from Unique while it is borrowed", BorrowError::ErrorCode::MoveFromWithActiveBorrows);
+                }
+
+                destroy();            // Clean up current resource
+                data = other.data;    // Transfer ownership
+                other.data = nullptr; // Nullify the moved-from object
+                this->deleter() = std::move(other.deleter());
+                // Borrow state is zero on both sides at this point, nothing to transfer
+            }
+            return *this;
+        }
+
+        OWNERSHIP_CONSTEXPR Deleter &get_deleter() { return this->deleter(); }
+        OWNERSHIP_CONSTEXPR const Deleter &get_deleter() const { return this->deleter(); }
+
+        OWNERSHIP_CONSTEXPR explicit operator bool() const { return data != nullptr; } // Check if the pointer is valid
+    };
+}
+
+// Unique - Enforce ownership semantics (no copies, moves only).
+template <typename T, typename Deleter>
+class Unique : public ownership_detail::UniqueStorage<T, Deleter>
+{
+    using Base = ownership_detail::UniqueStorage<T, Deleter>;
+    using Base::data;
+
+public:
+    OWNERSHIP_CONSTEXPR Unique(T *ptr, Deleter deleter = Deleter()) : Base(ptr, std::move(deleter)) {}
+
+    // Borrow methods
+    OWNERSHIP_CONSTEXPR Borrowed<T> borrow(OWNERSHIP_SITE_PARAM) const
+    {
+        return Borrowed<T>(this, data OWNERSHIP_TRACE_ONLY(, site));
     }
 
-    const T &operator*() const
+    OWNERSHIP_CONSTEXPR BorrowedMut<T> borrow_mut(OWNERSHIP_SITE_PARAM)
     {
-        if (mutable_borrowed)
+        return BorrowedMut<T>(this, data OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    // Non-throwing borrows; on conflict the result carries the error code instead
+    OWNERSHIP_CONSTEXPR BorrowResult<Borrowed<T>> try_borrow(OWNERSHIP_SITE_PARAM) const
+    {
+        if (!this->tryAcquireImmutableBorrow(OWNERSHIP_TRACE_ONLY(site)))
+            return BorrowError::ErrorCode::ImmutableBorrowOfMutablyBorrowed;
+        return Borrowed<T>(adopt_borrow, this, data OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    OWNERSHIP_CONSTEXPR BorrowResult<BorrowedMut<T>> try_borrow_mut(OWNERSHIP_SITE_PARAM)
+    {
+        if (!this->tryAcquireMutableBorrow(1 OWNERSHIP_TRACE_ONLY(, site)))
+            return this->mutableBorrowConflict();
+        return BorrowedMut<T>(adopt_borrow, this, data OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    // Mutably borrow several distinct fields at once, e.g.
+    // auto [x, y] = point.borrow_fields_mut(&Point::x, &Point::y);
+    // The borrows do not conflict with each other, only with other borrows of the owner.
+    template <typename U = T, typename... Fields>
+    OWNERSHIP_CONSTEXPR std::tuple<BorrowedMut<Fields>...> borrow_fields_mut(Fields U::*...fields)
+    {
+        static_assert(sizeof...(Fields) > 0, "borrow_fields_mut needs at least one field");
+        const void *addresses[] = {static_cast<const void *>(&(data->*fields))...};
+        for (std::size_t i = 0; i < sizeof...(Fields); ++i)
         {
-            throw BorrowError("Cannot access directly while mutably borrowed", BorrowError::ErrorCode::AccessWhileMutablyBorrowed);
+            for (std::size_t j = i + 1; j < sizeof...(Fields); ++j)
+            {
+                if (addresses[i] == addresses[j])
+                {
+                    throw BorrowError("Cannot mutably borrow the same field twice", BorrowError::ErrorCode::MutableBorrowOfMutablyBorrowed);
+                }
+            }
         }
+        this->acquireMutableBorrow(sizeof...(Fields) OWNERSHIP_TRACE_ONLY(, ownership_trace::Site()));
+        return std::tuple<BorrowedMut<Fields>...>(BorrowedMut<Fields>(adopt_borrow, this, &(data->*fields) OWNERSHIP_TRACE_ONLY(, ownership_trace::Site()))...);
+    }
+
+    // Accessors
+    OWNERSHIP_CONSTEXPR T *operator->()
+    {
+        this->checkAccess();
+        return data;
+    }
+
+    OWNERSHIP_CONSTEXPR const T *operator->() const
+    {
+        this->checkConstAccess();
+        return data;
+    }
+
+    OWNERSHIP_CONSTEXPR T &operator*()
+    {
+        this->checkAccess();
+        return *data;
+    }
+
+    OWNERSHIP_CONSTEXPR const T &operator*() const
+    {
+        this->checkConstAccess();
         return *data;
     }
 
-    T *get()
+    OWNERSHIP_CONSTEXPR T *get()
     {
-        if (immutable_borrows > 0 || mutable_borrowed)
+        this->checkAccess();
+        return data;
+    }
+
+    OWNERSHIP_CONSTEXPR const T *get() const
+    {
+        this->checkConstAccess();
+        return data;
+    }
+};
+
+// Unique<T[]> - Owns a heap array of known length. Besides borrowing the whole
+// array as a span, single elements and subranges can be borrowed; every kind of
+// borrow counts against the same owner.
+template <typename T, typename Deleter>
+class Unique<T[], Deleter> : public ownership_detail::UniqueStorage<T, Deleter>
+{
+    using Base = ownership_detail::UniqueStorage<T, Deleter>;
+    using Base::data;
+    std::size_t size_;
+
+    OWNERSHIP_CONSTEXPR void checkRange(std::size_t offset, std::size_t count) const
+    {
+        if (offset > size_ || count > size_ - offset)
         {
-            throw BorrowError("Cannot access directly while borrowed", BorrowError::ErrorCode::AccessWhileBorrowed);
+            throw std::out_of_range("Unique<T[]> borrow out of range");
         }
-        return data;
     }
 
-    const T *get() const
+public:
+    OWNERSHIP_CONSTEXPR Unique(T *ptr, std::size_t size, Deleter deleter = Deleter()) : Base(ptr, std::move(deleter)), size_(size) {}
+
+    // The length moves with the array
+    OWNERSHIP_CONSTEXPR Unique(Unique &&other) noexcept(false) : Base(std::move(other)), size_(other.size_)
+    {
+        other.size_ = 0;
+    }
+
+    OWNERSHIP_CONSTEXPR Unique &operator=(Unique &&other) noexcept(false)
     {
-        if (mutable_borrowed)
+        if (this != &other)
         {
-            throw BorrowError("Cannot access directly while mutably borrowed", BorrowError::ErrorCode::AccessWhileMutablyBorrowed);
+            Base::operator=(std::move(other));
+            size_ = other.size_;
+            other.size_ = 0;
         }
+        return *this;
+    }
+
+    OWNERSHIP_CONSTEXPR std::size_t size() const { return size_; }
+
+    // Borrow the whole array
+    OWNERSHIP_CONSTEXPR Borrowed<T[]> borrow(OWNERSHIP_SITE_PARAM) const
+    {
+        return Borrowed<T[]>(this, data, size_ OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    OWNERSHIP_CONSTEXPR BorrowedMut<T[]> borrow_mut(OWNERSHIP_SITE_PARAM)
+    {
+        return BorrowedMut<T[]>(this, data, size_ OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    OWNERSHIP_CONSTEXPR BorrowResult<Borrowed<T[]>> try_borrow(OWNERSHIP_SITE_PARAM) const
+    {
+        if (!this->tryAcquireImmutableBorrow(OWNERSHIP_TRACE_ONLY(site)))
+            return BorrowError::ErrorCode::ImmutableBorrowOfMutablyBorrowed;
+        return Borrowed<T[]>(adopt_borrow, this, data, size_ OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    OWNERSHIP_CONSTEXPR BorrowResult<BorrowedMut<T[]>> try_borrow_mut(OWNERSHIP_SITE_PARAM)
+    {
+        if (!this->tryAcquireMutableBorrow(1 OWNERSHIP_TRACE_ONLY(, site)))
+            return this->mutableBorrowConflict();
+        return BorrowedMut<T[]>(adopt_borrow, this, data, size_ OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    // Borrow one element; throws std::out_of_range past the end
+    OWNERSHIP_CONSTEXPR Borrowed<T> borrow_at(std::size_t index OWNERSHIP_SITE_PARAM_NEXT) const
+    {
+        checkRange(index, 1);
+        return Borrowed<T>(this, data + index OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    OWNERSHIP_CONSTEXPR BorrowedMut<T> borrow_mut_at(std::size_t index OWNERSHIP_SITE_PARAM_NEXT)
+    {
+        checkRange(index, 1);
+        return BorrowedMut<T>(this, data + index OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    // Borrow count elements starting at offset
+    OWNERSHIP_CONSTEXPR Borrowed<T[]> borrow_slice(std::size_t offset, std::size_t count OWNERSHIP_SITE_PARAM_NEXT) const
+    {
+        checkRange(offset, count);
+        return Borrowed<T[]>(this, data + offset, count OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    OWNERSHIP_CONSTEXPR BorrowedMut<T[]> borrow_mut_slice(std::size_t offset, std::size_t count OWNERSHIP_SITE_PARAM_NEXT)
+    {
+        checkRange(offset, count);
+        return BorrowedMut<T[]>(this, data + offset, count OWNERSHIP_TRACE_ONLY(, site));
+    }
+
+    // Mutably borrow [0, mid) and [mid, size()) as two views that do not conflict
+    // with each other, e.g. to process both halves on different threads
+    OWNERSHIP_CONSTEXPR std::pair<BorrowedMut<T[]>, BorrowedMut<T[]>> split_at_mut(std::size_t mid OWNERSHIP_SITE_PARAM_NEXT)
+    {
+        checkRange(mid, 0);
+        this->acquireMutableBorrow(2 OWNERSHIP_TRACE_ONLY(, site));
+        return {BorrowedMut<T[]>(adopt_borrow, this, data, mid OWNERSHIP_TRACE_ONLY(, site)),
+                BorrowedMut<T[]>(adopt_borrow, this, data + mid, size_ - mid OWNERSHIP_TRACE_ONLY(, site))};
+    }
+
+    // Accessors
+    OWNERSHIP_CONSTEXPR T &operator[](std::size_t index)
+    {
+        this->checkAccess();
+        return data[index];
+    }
+
+    OWNERSHIP_CONSTEXPR const T &operator[](std::size_t index) const
+    {
+        this->checkConstAccess();
+        return data[index];
+    }
+
+    OWNERSHIP_CONSTEXPR T *get()
+    {
+        this->checkAccess();
         return data;
     }
 
-    explicit operator bool() const { return data != nullptr; } // Check if the pointer is valid
+    OWNERSHIP_CONSTEXPR const T *get() const
+    {
+        this->checkConstAccess();
+        return data;
+    }
 };
 
 // Borrowed - Represent immutable borrows with restricted lifetimes
 template <typename T>
 class Borrowed
 {
-    const Unique<T> *owner_;
+#ifndef OWNERSHIP_UNCHECKED
+    const BorrowTracker *owner_;
+#endif
     const T *data;
+    OWNERSHIP_TRACE_ONLY(ownership_trace::Site site_;) // Where the borrow was taken, for its release event
 
 public:
-    explicit Borrowed(const Unique<T> *owner, const T *ptr) : owner_(owner), data(ptr)
+#ifdef OWNERSHIP_UNCHECKED
+    // A bare pointer; copies, assignment and destruction are trivial
+    OWNERSHIP_CONSTEXPR explicit Borrowed(const BorrowTracker *, const T *ptr) : data(ptr) {}
+    OWNERSHIP_CONSTEXPR Borrowed(AdoptBorrow, const BorrowTracker *, const T *ptr) noexcept : data(ptr) {}
+#else
+    OWNERSHIP_CONSTEXPR explicit Borrowed(const BorrowTracker *owner, const T *ptr OWNERSHIP_SITE_PARAM_NEXT)
+        : owner_(owner), data(ptr) OWNERSHIP_TRACE_ONLY(, site_(site))
     {
-        owner_->acquireImmutableBorrow();
+        owner_->acquireImmutableBorrow(OWNERSHIP_TRACE_ONLY(site_));
     }
 
+    // Takes over an immutable borrow already acquired on owner
+    OWNERSHIP_CONSTEXPR Borrowed(AdoptBorrow, const BorrowTracker *owner, const T *ptr OWNERSHIP_SITE_PARAM_NEXT) noexcept
+        : owner_(owner), data(ptr) OWNERSHIP_TRACE_ONLY(, site_(site)) {}
+
     // Copy constructor
-    Borrowed(const Borrowed &other) : owner_(other.owner_), data(other.data)
+    OWNERSHIP_CONSTEXPR Borrowed(const Borrowed &other OWNERSHIP_SITE_PARAM_NEXT)
+        : owner_(other.owner_), data(other.data) OWNERSHIP_TRACE_ONLY(, site_(site))
     {
-        owner_->acquireImmutableBorrow();
+        if (owner_)
+            owner_->acquireImmutableBorrow(OWNERSHIP_TRACE_ONLY(site_));
     }
 
     // Copy assignment
-    Borrowed &operator=(const Borrowed &other)
+    OWNERSHIP_CONSTEXPR Borrowed &operator=(const Borrowed &other)
     {
         if (this != &other)
         {
-            owner_->releaseBorrowImmutable();
+            if (owner_)
+                owner_->releaseBorrowImmutable(OWNERSHIP_TRACE_ONLY(site_));
             owner_ = other.owner_;
             data = other.data;
-            owner_->acquireImmutableBorrow();
+            OWNERSHIP_TRACE_ONLY(site_ = other.site_;)
+            if (owner_)
+                owner_->acquireImmutableBorrow(OWNERSHIP_TRACE_ONLY(site_));
+        }
+        return *this;
+    }
+
+    // Move constructor
+    // The borrow itself is transferred, so the owner's count is untouched. This keeps
+    // returning a Borrowed and reallocating a std::vector<Borrowed<T>> cheap.
+    OWNERSHIP_CONSTEXPR Borrowed(Borrowed &&other) noexcept
+        : owner_(other.owner_), data(other.data) OWNERSHIP_TRACE_ONLY(, site_(other.site_))
+    {
+        other.owner_ = nullptr;
+        other.data = nullptr;
+    }
+
+    // Move assignment
+    OWNERSHIP_CONSTEXPR Borrowed &operator=(Borrowed &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (owner_)
+                owner_->releaseBorrowImmutable(OWNERSHIP_TRACE_ONLY(site_));
+            owner_ = other.owner_;
+            data = other.data;
+            OWNERSHIP_TRACE_ONLY(site_ = other.site_;)
+            other.owner_ = nullptr;
+            other.data = nullptr;
         }
         return *this;
     }
 
     // Destructor
-    ~Borrowed()
+    OWNERSHIP_CONSTEXPR ~Borrowed()
     {
-        owner_->releaseBorrowImmutable();
+        if (owner_)
+            owner_->releaseBorrowImmutable(OWNERSHIP_TRACE_ONLY(site_));
     }
+#endif
 
-    const T *operator->() const { return data; }
-    const T &operator*() const { return *data; }
-    const T *get() const { return data; }
-    explicit operator bool() const { return data != nullptr; }
+    OWNERSHIP_CONSTEXPR const T *operator->() const { return data; }
+    OWNERSHIP_CONSTEXPR const T &operator*() const { return *data; }
+    OWNERSHIP_CONSTEXPR const T *get() const { return data; }
+    OWNERSHIP_CONSTEXPR explicit operator bool() const { return data != nullptr; }
 };
 
 // BorrowedMut - Represent mutable borrows with restricted lifetimes
 template <typename T>
 class BorrowedMut
 {
-    const Unique<T> *owner_;
+#ifndef OWNERSHIP_UNCHECKED
+    const BorrowTracker *owner_;
+#endif
     T *data;
+    OWNERSHIP_TRACE_ONLY(ownership_trace::Site site_;) // Where the borrow was taken, for its release event
 
 public:
-    explicit BorrowedMut(const Unique<T> *owner, T *ptr) : owner_(owner), data(ptr)
+#ifdef OWNERSHIP_UNCHECKED
+    // A bare pointer; moves and destruction are trivial
+    OWNERSHIP_CONSTEXPR explicit BorrowedMut(const BorrowTracker *, T *ptr) : data(ptr) {}
+    OWNERSHIP_CONSTEXPR BorrowedMut(AdoptBorrow, const BorrowTracker *, T *ptr) noexcept : data(ptr) {}
+
+    // Disallow copying (enforce move semantics)
+    BorrowedMut(const BorrowedMut &) = delete;
+    BorrowedMut &operator=(const BorrowedMut &) = delete;
+    BorrowedMut(BorrowedMut &&) = default;
+    BorrowedMut &operator=(BorrowedMut &&) = default;
+#else
+    OWNERSHIP_CONSTEXPR explicit BorrowedMut(const BorrowTracker *owner, T *ptr OWNERSHIP_SITE_PARAM_NEXT)
+        : owner_(owner), data(ptr) OWNERSHIP_TRACE_ONLY(, site_(site))
     {
-        owner_->acquireMutableBorrow();
+        owner_->acquireMutableBorrow(1 OWNERSHIP_TRACE_ONLY(, site_));
     }
 
+    // Takes over a mutable borrow already acquired on owner
+    OWNERSHIP_CONSTEXPR BorrowedMut(AdoptBorrow, const BorrowTracker *owner, T *ptr OWNERSHIP_SITE_PARAM_NEXT) noexcept
+        : owner_(owner), data(ptr) OWNERSHIP_TRACE_ONLY(, site_(site)) {}
+
     // Disallow copying (enforce move semantics)
     BorrowedMut(const BorrowedMut &) = delete;
     BorrowedMut &operator=(const BorrowedMut &) = delete;
 
     // Move constructor
-    BorrowedMut(BorrowedMut &&other) noexcept : owner_(other.owner_), data(other.data)
+    OWNERSHIP_CONSTEXPR BorrowedMut(BorrowedMut &&other) noexcept
+        : owner_(other.owner_), data(other.data) OWNERSHIP_TRACE_ONLY(, site_(other.site_))
     {
         other.owner_ = nullptr;
         other.data = nullptr;
     }
 
     // Move assignment
-    BorrowedMut &operator=(BorrowedMut &&other) noexcept
+    OWNERSHIP_CONSTEXPR BorrowedMut &operator=(BorrowedMut &&other) noexcept
     {
         if (this != &other)
         {
             if (owner_)
-                owner_->releaseMutableBorrow();
+                owner_->releaseMutableBorrow(OWNERSHIP_TRACE_ONLY(site_));
             owner_ = other.owner_;
             data = other.data;
+            OWNERSHIP_TRACE_ONLY(site_ = other.site_;)
             other.owner_ = nullptr;
             other.data = nullptr;
         }
@@ -302,17 +923,153 @@ public:
     }
 
     // Destructor
-    ~BorrowedMut()
+    OWNERSHIP_CONSTEXPR ~BorrowedMut()
     {
         if (owner_)
-            owner_->releaseMutableBorrow();
+            owner_->releaseMutableBorrow(OWNERSHIP_TRACE_ONLY(site_));
+    }
+#endif
+
+    OWNERSHIP_CONSTEXPR T *operator->() { return data; }
+    OWNERSHIP_CONSTEXPR const T *operator->() const { return data; }
+    OWNERSHIP_CONSTEXPR T &operator*() { return *data; }
+    OWNERSHIP_CONSTEXPR const T &operator*() const { return *data; }
+    OWNERSHIP_CONSTEXPR T *get() { return data; }
+    OWNERSHIP_CONSTEXPR const T *get() const { return data; }
+    OWNERSHIP_CONSTEXPR explicit operator bool() const { return data != nullptr; }
+};
+
+// Borrowed<T[]> - Immutable view of a contiguous range owned by a Unique<T[]>.
+// The borrow itself is held by a Borrowed<T> on the first element.
+template <typename T>
+class Borrowed<T[]>
+{
+    Borrowed<T> first_;
+    std::size_t size_;
+
+public:
+    OWNERSHIP_CONSTEXPR explicit Borrowed(const BorrowTracker *owner, const T *ptr, std::size_t size OWNERSHIP_SITE_PARAM_NEXT)
+        : first_(owner, ptr OWNERSHIP_TRACE_ONLY(, site)), size_(size) {}
+    OWNERSHIP_CONSTEXPR Borrowed(AdoptBorrow, const BorrowTracker *owner, const T *ptr, std::size_t size OWNERSHIP_SITE_PARAM_NEXT) noexcept
+        : first_(adopt_borrow, owner, ptr OWNERSHIP_TRACE_ONLY(, site)), size_(size) {}
+
+    OWNERSHIP_CONSTEXPR const T &operator[](std::size_t index) const { return first_.get()[index]; }
+    OWNERSHIP_CONSTEXPR const T *get() const { return first_.get(); }
+    OWNERSHIP_CONSTEXPR const T *begin() const { return first_.get(); }
+    OWNERSHIP_CONSTEXPR const T *end() const { return first_.get() + size(); }
+    OWNERSHIP_CONSTEXPR std::size_t size() const { return first_ ? size_ : 0; }
+    OWNERSHIP_CONSTEXPR bool empty() const { return size() == 0; }
+    OWNERSHIP_CONSTEXPR explicit operator bool() const { return static_cast<bool>(first_); }
+};
+
+// BorrowedMut<T[]> - Mutable view of a contiguous range owned by a Unique<T[]>
+template <typename T>
+class BorrowedMut<T[]>
+{
+    BorrowedMut<T> first_;
+    std::size_t size_;
+
+public:
+    OWNERSHIP_CONSTEXPR explicit BorrowedMut(const BorrowTracker *owner, T *ptr, std::size_t size OWNERSHIP_SITE_PARAM_NEXT)
+        : first_(owner, ptr OWNERSHIP_TRACE_ONLY(, site)), size_(size) {}
+    OWNERSHIP_CONSTEXPR BorrowedMut(AdoptBorrow, const BorrowTracker *owner, T *ptr, std::size_t size OWNERSHIP_SITE_PARAM_NEXT) noexcept
+        : first_(adopt_borrow, owner, ptr OWNERSHIP_TRACE_ONLY(, site)), size_(size) {}
+
+    OWNERSHIP_CONSTEXPR T &operator[](std::size_t index) { return first_.get()[index]; }
+    OWNERSHIP_CONSTEXPR const T &operator[](std::size_t index) const { return first_.get()[index]; }
+    OWNERSHIP_CONSTEXPR T *get() { return first_.get(); }
+    OWNERSHIP_CONSTEXPR const T *get() const { return first_.get(); }
+    OWNERSHIP_CONSTEXPR T *begin() { return first_.get(); }
+    OWNERSHIP_CONSTEXPR T *end() { return first_.get() + size(); }
+    OWNERSHIP_CONSTEXPR const T *begin() const { return first_.get(); }
+    OWNERSHIP_CONSTEXPR const T *end() const { return first_.get() + size(); }
+    OWNERSHIP_CONSTEXPR std::size_t size() const { return first_ ? size_ : 0; }
+    OWNERSHIP_CONSTEXPR bool empty() const { return size() == 0; }
+    OWNERSHIP_CONSTEXPR explicit operator bool() const { return static_cast<bool>(first_); }
+};
+
+// MonotonicArena - Bump allocator for Unique objects that share a lifetime.
+// Allocation is a pointer increment and all memory is returned at once when the
+// arena is released or destroyed. The arena must outlive every Unique in it.
+class MonotonicArena
+{
+    struct Block
+    {
+        Block *next;
+    };
+
+    Block *head_ = nullptr;
+    char *cursor_ = nullptr;
+    char *end_ = nullptr;
+    std::size_t nextBlockSize_;
+
+    static char *alignUp(char *ptr, std::size_t align)
+    {
+        std::uintptr_t value = reinterpret_cast<std::uintptr_t>(ptr);
+        return reinterpret_cast<char *>((value + align - 1) & ~(std::uintptr_t(align) - 1));
     }
 
-    T *operator->() { return data; }
-    const T *operator->() const { return data; }
-    T &operator*() { return *data; }
-    const T &operator*() const { return *data; }
-    T *get() { return data; }
-    const T *get() const { return data; }
-    explicit operator bool() const { return data != nullptr; }
-};
\ No newline at end of file
+    // Starts a new block large enough for size bytes at align, doubling the block size
+    void grow(std::size_t size, std::size_t align)
+    {
+        std::size_t needed = sizeof(Block) + size + align;
+        std::size_t blockSize = nextBlockSize_ > needed ? nextBlockSize_ : needed;
+        Block *block = static_cast<Block *>(::operator new(blockSize));
+        block->next = head_;
+        head_ = block;
+        cursor_ = reinterpret_cast<char *>(block + 1);
+        end_ = reinterpret_cast<char *>(block) + blockSize;
+        nextBlockSize_ = blockSize * 2;
+    }
+
+public:
+    explicit MonotonicArena(std::size_t initialBlockSize = 4096) : nextBlockSize_(initialBlockSize) {}
+    ~MonotonicArena() { release(); }
+
+    MonotonicArena(const MonotonicArena &) = delete;
+    MonotonicArena &operator=(const MonotonicArena &) = delete;
+
+    // align must be a power of two
+    void *allocate(std::size_t size, std::size_t align)
+    {
+        char *ptr = alignUp(cursor_, align);
+        if (!cursor_ || ptr > end_ || size > static_cast<std::size_t>(end_ - ptr))
+        {
+            grow(size, align);
+            ptr = alignUp(cursor_, align);
+        }
+        cursor_ = ptr + size;
+        return ptr;
+    }
+
+    // Frees every block. Objects still in the arena are not destroyed.
+    void release()
+    {
+        while (head_)
+        {
+            Block *next = head_->next;
+            ::operator delete(head_);
+            head_ = next;
+        }
+        cursor_ = end_ = nullptr;
+    }
+};
+
+// ArenaDeleter - Destroys an object in place and leaves its memory to the arena.
+// It is stateless, so an arena-backed Unique is still the size of a Unique<T>.
+template <typename T>
+struct ArenaDeleter
+{
+    void operator()(T *ptr) const { ptr->~T(); }
+};
+
+template <typename T>
+using ArenaUnique = Unique<T, ArenaDeleter<T>>;
+
+// make_unique_in - Constructs a T in arena and returns its owner
+template <typename T, typename... Args>
+ArenaUnique<T> make_unique_in(MonotonicArena &arena, Args &&...args)
+{
+    void *memory = arena.allocate(sizeof(T), alignof(T));
+    return ArenaUnique<T>(::new (memory) T(std::forward<Args>(args)...));
+}
@@ -0,0 +1,102 @@
+// ownership_mmap.h
+// Memory-mapped files under the ownership model (POSIX only). map_file<T>()
+// maps a file read-only as a MappedFile<T>, a Unique<const T[]>;
+// map_file_mut<T>() maps it shared and writable as a MappedFileMut<T>, a
+// Unique<T[]>. Borrowing one yields a typed span straight over the mapped
+// pages, so readers hold Borrowed<const T[]> views with no copy and a single
+// writer updates the file in place through a BorrowedMut<T[]>. The mapping is
+// unmapped when the owner is destroyed.
+
+#pragma once
+
+#include "ownership.h"
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// MunmapDeleter - Unmaps what map_file mapped. It keeps the length of the
+// mapping in bytes, which can be more than size() elements of T.
+template <typename T>
+struct MunmapDeleter
+{
+    std::size_t bytes = 0;
+
+    void operator()(T *ptr) const
+    {
+        munmap(const_cast<std::remove_const_t<T> *>(ptr), bytes);
+    }
+};
+
+template <typename T>
+using MappedFile = Unique<const T[], MunmapDeleter<const T>>;
+
+template <typename T>
+using MappedFileMut = Unique<T[], MunmapDeleter<T>>;
+
+namespace ownership_detail
+{
+    // Maps all of path; returns nullptr for an empty file and throws
+    // std::system_error if the file cannot be opened or mapped
+    inline void *mapFile(const std::string &path, bool writable, std::size_t &bytes)
+    {
+        int fd = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "Cannot open " + path);
+        }
+
+        struct stat status;
+        if (fstat(fd, &status) != 0)
+        {
+            int error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(), "Cannot stat " + path);
+        }
+        bytes = static_cast<std::size_t>(status.st_size);
+        if (bytes == 0)
+        {
+            close(fd);
+            return nullptr;
+        }
+
+        // The mapping stays valid after the descriptor is closed
+        void *ptr = mmap(nullptr, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                         writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+        int error = errno;
+        close(fd);
+        if (ptr == MAP_FAILED)
+        {
+            throw std::system_error(error, std::generic_category(), "Cannot map " + path);
+        }
+        return ptr;
+    }
+}
+
+// Maps path read-only as an array of T. A trailing partial element is not part
+// of the array.
+template <typename T>
+MappedFile<T> map_file(const std::string &path)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "map_file needs a trivially copyable T");
+    std::size_t bytes = 0;
+    const T *data = static_cast<const T *>(ownership_detail::mapFile(path, false, bytes));
+    return MappedFile<T>(data, bytes / sizeof(T), MunmapDeleter<const T>{bytes});
+}
+
+// Maps path shared and writable as an array of T. Writes reach the file
+// through the page cache; call msync on the mapping for durability.
+template <typename T>
+MappedFileMut<T> map_file_mut(const std::string &path)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "map_file_mut needs a trivially copyable T");
+    std::size_t bytes = 0;
+    T *data = static_cast<T *>(ownership_detail::mapFile(path, true, bytes));
+    return MappedFileMut<T>(data, bytes / sizeof(T), MunmapDeleter<T>{bytes});
+}
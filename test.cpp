@@ -12,6 +12,18 @@ void foo()
     Borrowed<int> b2 = globalData.borrow();
 }
 
+struct Point
+{
+    int x, y;
+};
+
+void fields()
+{
+    Unique<Point> point(new Point{1, 2});
+    auto [x, y] = point.borrow_fields_mut(&Point::x, &Point::y);
+    Borrowed<Point> p = point.borrow(); // error: Cannot immutably borrow 'point' while it is mutably borrowed
+}
+
 int main()
 {
     Unique<int> data(new int(42));
@@ -26,8 +38,8 @@ int main()
     }
     Borrowed<int> b = globalData.borrow();
 
-    // The case below the compiler does not catch
-    // the runtime error will be thrown, but just be aware that
+    // The case below is only caught by the plugin with -escape-analysis
+    // Without it, the runtime error will be thrown, but just be aware that
     // the compiler will not catch this
     std::vector<Borrowed<int>> borrowed;
     {
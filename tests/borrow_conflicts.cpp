@@ -0,0 +1,66 @@
+// Basic borrow conflicts, reported by both engines
+#include "ownership.h"
+
+Unique<int> global(new int(0));
+Borrowed<int> globalView = global.borrow();
+
+void immutableThenMutable()
+{
+    Unique<int> data(new int(1));
+    Borrowed<int> view = data.borrow();
+    BorrowedMut<int> edit = data.borrow_mut(); // expected-error {{Cannot mutably borrow 'data' while it is immutably borrowed}}
+}
+
+void mutableThenImmutable()
+{
+    Unique<int> data(new int(1));
+    BorrowedMut<int> edit = data.borrow_mut();
+    Borrowed<int> view = data.borrow(); // expected-error {{Cannot immutably borrow 'data' while it is mutably borrowed}}
+}
+
+void mutableTwice()
+{
+    Unique<int> data(new int(1));
+    BorrowedMut<int> edit = data.borrow_mut();
+    BorrowedMut<int> again = data.borrow_mut(); // expected-error {{Cannot mutably borrow 'data' while it is already mutably borrowed}}
+}
+
+void sharedBorrows()
+{
+    Unique<int> data(new int(1));
+    Borrowed<int> first = data.borrow();
+    Borrowed<int> second = data.borrow();
+}
+
+// A temporary borrow is checked, but ends with its statement
+void temporaryBorrows()
+{
+    Unique<int> data(new int(1));
+    *data.borrow_mut() = 2;
+    Borrowed<int> view = data.borrow();
+    *data.borrow_mut() = 3; // expected-error {{Cannot mutably borrow 'data' while it is immutably borrowed}}
+}
+
+// globalView keeps global borrowed in every function
+void borrowGlobal()
+{
+    BorrowedMut<int> edit = global.borrow_mut(); // expected-error {{Cannot mutably borrow 'global' while it is immutably borrowed}}
+}
+
+// A borrower assigned a new borrow gives up the one it held
+void reassignedBorrower()
+{
+    Unique<int> first(new int(1));
+    Unique<int> second(new int(2));
+    Borrowed<int> view = first.borrow();
+    view = second.borrow();
+    BorrowedMut<int> edit = first.borrow_mut();
+}
+
+// The new borrow is taken before the borrower gives up its old one
+void reassignedToSameOwner()
+{
+    Unique<int> data(new int(1));
+    BorrowedMut<int> edit = data.borrow_mut();
+    edit = data.borrow_mut(); // expected-error {{Cannot mutably borrow 'data' while it is already mutably borrowed}}
+}
@@ -0,0 +1,56 @@
+// Borrows that end on some paths only. The CFG engine follows control flow;
+// the lexical engine ends a borrow when the block declaring its borrower closes.
+#include "ownership.h"
+
+void borrowInBranch(bool flag)
+{
+    Unique<int> data(new int(1));
+    if (flag)
+    {
+        Borrowed<int> view = data.borrow();
+    }
+    BorrowedMut<int> edit = data.borrow_mut();
+}
+
+void borrowInLoop()
+{
+    Unique<int> data(new int(0));
+    for (int i = 0; i < 3; ++i)
+    {
+        BorrowedMut<int> edit = data.borrow_mut();
+        ++*edit;
+    }
+    Borrowed<int> view = data.borrow();
+}
+
+void borrowBeforeEarlyReturn(bool flag)
+{
+    Unique<int> data(new int(1));
+    {
+        BorrowedMut<int> edit = data.borrow_mut();
+        if (flag)
+            return;
+        *edit = 2;
+    }
+    Borrowed<int> view = data.borrow();
+}
+
+void conflictOnOnePath(bool flag)
+{
+    Unique<int> data(new int(1));
+    BorrowedMut<int> edit = data.borrow_mut();
+    if (flag)
+    {
+        Borrowed<int> view = data.borrow(); // expected-error {{Cannot immutably borrow 'data' while it is mutably borrowed}}
+    }
+}
+
+// A condition variable is destroyed at the end of its if statement. The
+// lexical engine keeps its borrow until the function body closes.
+void conditionVariable()
+{
+    Unique<int> data(new int(1));
+    if (BorrowResult<BorrowedMut<int>> edit = data.try_borrow_mut())
+        **edit = 2;
+    Borrowed<int> view = data.borrow(); // lexical-error {{Cannot immutably borrow 'data' while it is mutably borrowed}}
+}
@@ -0,0 +1,83 @@
+// PLUGIN-ARGS: -escape-analysis
+// Borrows stored outside a local borrower variable. Only the lexical engine
+// follows them.
+#include "ownership.h"
+#include <vector>
+
+void localBorrower()
+{
+    Unique<int> data(new int(1));
+    Borrowed<int> view = data.borrow();
+    BorrowedMut<int> edit = data.borrow_mut(); // expected-error {{Cannot mutably borrow 'data' while it is immutably borrowed}}
+}
+
+void containerKeepsBorrow()
+{
+    Unique<int> data(new int(1));
+    std::vector<Borrowed<int>> views;
+    views.push_back(data.borrow());
+    BorrowedMut<int> edit = data.borrow_mut(); // lexical-error {{Cannot mutably borrow 'data' while it is immutably borrowed}}
+}
+
+void containerOutlivesOwner()
+{
+    std::vector<Borrowed<int>> views;
+    {
+        Unique<int> data(new int(1));
+        views.push_back(data.borrow()); // lexical-error {{Borrow of 'data' is kept by something that outlives it}}
+    }
+}
+
+void assignedToOuterVariable(const Unique<int> &other)
+{
+    Borrowed<int> view = other.borrow();
+    {
+        Unique<int> data(new int(1));
+        view = data.borrow(); // lexical-error {{Borrow of 'data' is kept by something that outlives it}}
+    }
+}
+
+struct Holder
+{
+    Borrowed<int> view;
+
+    void keep()
+    {
+        Unique<int> data(new int(1));
+        view = data.borrow(); // lexical-error {{Borrow of 'data' is kept by something that outlives it}}
+    }
+};
+
+// Assigning a new borrow to view ends the borrow it held
+void reassignedBorrower()
+{
+    Unique<int> first(new int(1));
+    Unique<int> second(new int(2));
+    Borrowed<int> view = first.borrow();
+    view = second.borrow();
+    BorrowedMut<int> edit = first.borrow_mut();
+    BorrowedMut<int> other = second.borrow_mut(); // lexical-error {{Cannot mutably borrow 'second' while it is immutably borrowed}}
+}
+
+Borrowed<int> returnLocalBorrow()
+{
+    Unique<int> data(new int(1));
+    return data.borrow(); // lexical-error {{Borrow of 'data' is kept by something that outlives it}}
+}
+
+// A parameter outlives the call, so its borrow may be returned
+Borrowed<int> returnParameterBorrow(const Unique<int> &data)
+{
+    return data.borrow();
+}
+
+// A Unique taken by value is destroyed when the call returns
+Borrowed<int> returnByValueParameterBorrow(Unique<int> data)
+{
+    return data.borrow(); // lexical-error {{Borrow of 'data' is kept by something that outlives it}}
+}
+
+void storeByValueParameterBorrow(Unique<int> data, std::vector<Borrowed<int>> &out)
+{
+    out.push_back(data.borrow()); // lexical-error {{Borrow of 'data' is kept by something that outlives it}}
+}
@@ -0,0 +1,20 @@
+// PLUGIN-ARGS: -max-diags-per-function=2
+// A template whose borrows depend on its arguments is checked in each
+// instantiation as well as in the pattern; what they both find is reported once
+#include "ownership.h"
+
+template <typename Owner>
+void conflictsInTemplate(Owner &owner)
+{
+    Borrowed<int> probe = owner.borrow();
+    Unique<int> data(new int(1));
+    BorrowedMut<int> edit = data.borrow_mut();
+    Borrowed<int> first = data.borrow(); // expected-error {{Cannot immutably borrow 'data' while it is mutably borrowed}}
+    Borrowed<int> second = data.borrow(); // expected-error {{Cannot immutably borrow 'data' while it is mutably borrowed}} expected-note {{Too many borrow errors in 'conflictsInTemplate'; skipping the rest of the function}}
+}
+
+void instantiate()
+{
+    Unique<int> owner(new int(0));
+    conflictsInTemplate(owner);
+}
@@ -0,0 +1,48 @@
+// A borrow held by a variable ends when the variable goes out of scope
+#include "ownership.h"
+
+void borrowEndsWithBlock()
+{
+    Unique<int> data(new int(1));
+    {
+        BorrowedMut<int> edit = data.borrow_mut();
+        *edit = 2;
+    }
+    Borrowed<int> view = data.borrow();
+}
+
+void innerBlockEndsFirst()
+{
+    Unique<int> data(new int(1));
+    Borrowed<int> outer = data.borrow();
+    {
+        Borrowed<int> inner = data.borrow();
+    }
+    BorrowedMut<int> edit = data.borrow_mut(); // expected-error {{Cannot mutably borrow 'data' while it is immutably borrowed}}
+}
+
+void siblingBlocks()
+{
+    Unique<int> data(new int(1));
+    {
+        BorrowedMut<int> first = data.borrow_mut();
+    }
+    {
+        BorrowedMut<int> second = data.borrow_mut();
+    }
+}
+
+// An owner declared in a block is a new owner each time it is declared
+void ownerPerBlock()
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        Unique<int> data(new int(i));
+        BorrowedMut<int> edit = data.borrow_mut();
+    }
+    {
+        Unique<int> data(new int(2));
+        BorrowedMut<int> edit = data.borrow_mut();
+        Borrowed<int> view = data.borrow(); // expected-error {{Cannot immutably borrow 'data' while it is mutably borrowed}}
+    }
+}
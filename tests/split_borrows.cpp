@@ -0,0 +1,43 @@
+// Split, field and element borrows. Each is one mutable or immutable borrow of
+// the whole owner: its parts never conflict with each other, only with other
+// borrows of the owner.
+#include "ownership.h"
+
+struct Point
+{
+    int x, y;
+};
+
+void splitHalves()
+{
+    Unique<int[]> values(new int[4], 4);
+    auto [left, right] = values.split_at_mut(2);
+    left[0] = right[0];
+    Borrowed<int[]> view = values.borrow(); // expected-error {{Cannot immutably borrow 'values' while it is mutably borrowed}}
+}
+
+void splitEndsWithScope()
+{
+    Unique<int[]> values(new int[4], 4);
+    {
+        auto [left, right] = values.split_at_mut(2);
+        left[0] = right[0];
+    }
+    BorrowedMut<int[]> all = values.borrow_mut();
+}
+
+void disjointFields()
+{
+    Unique<Point> point(new Point{1, 2});
+    auto [x, y] = point.borrow_fields_mut(&Point::x, &Point::y);
+    *x = *y;
+    BorrowedMut<Point> whole = point.borrow_mut(); // expected-error {{Cannot mutably borrow 'point' while it is already mutably borrowed}}
+}
+
+void elementBorrows()
+{
+    Unique<int[]> values(new int[4], 4);
+    Borrowed<int> first = values.borrow_at(0);
+    Borrowed<int[]> tail = values.borrow_slice(1, 3);
+    BorrowedMut<int> last = values.borrow_mut_at(3); // expected-error {{Cannot mutably borrow 'values' while it is immutably borrowed}}
+}
@@ -0,0 +1,34 @@
+// PLUGIN-ARGS: -max-diags-per-function=2
+// After two errors the rest of a function is skipped, with a note saying so
+#include "ownership.h"
+
+void manyConflicts()
+{
+    Unique<int> data(new int(1));
+    BorrowedMut<int> edit = data.borrow_mut();
+    Borrowed<int> first = data.borrow(); // expected-error {{Cannot immutably borrow 'data' while it is mutably borrowed}}
+    Borrowed<int> second = data.borrow(); // expected-error {{Cannot immutably borrow 'data' while it is mutably borrowed}} expected-note {{Too many borrow errors in 'manyConflicts'; skipping the rest of the function}}
+    Borrowed<int> third = data.borrow();
+}
+
+// The errors kept are the first ones in the source, whichever the blocks
+// they are in
+void manyConflictsAcrossBlocks(bool flag)
+{
+    Unique<int> data(new int(1));
+    BorrowedMut<int> edit = data.borrow_mut();
+    Borrowed<int> first = data.borrow(); // expected-error {{Cannot immutably borrow 'data' while it is mutably borrowed}}
+    if (flag)
+    {
+        Borrowed<int> second = data.borrow(); // expected-error {{Cannot immutably borrow 'data' while it is mutably borrowed}} expected-note {{Too many borrow errors in 'manyConflictsAcrossBlocks'; skipping the rest of the function}}
+    }
+    Borrowed<int> third = data.borrow();
+}
+
+// The limit is per function
+void nextFunction()
+{
+    Unique<int> data(new int(1));
+    BorrowedMut<int> edit = data.borrow_mut();
+    Borrowed<int> view = data.borrow(); // expected-error {{Cannot immutably borrow 'data' while it is mutably borrowed}}
+}
@@ -0,0 +1,53 @@
+// Moves out of and into Unique owners
+#include "ownership.h"
+
+void consume(Unique<int> owner);
+
+void useAfterMove()
+{
+    Unique<int> a(new int(1));
+    Unique<int> b(std::move(a));
+    Borrowed<int> view = a.borrow(); // expected-error {{Use of 'a' after it was moved from}}
+}
+
+void useAfterPassByValue()
+{
+    Unique<int> a(new int(1));
+    consume(std::move(a));
+    Borrowed<int> view = a.borrow(); // expected-error {{Use of 'a' after it was moved from}}
+}
+
+void reassignedAfterMove()
+{
+    Unique<int> a(new int(1));
+    Unique<int> b(std::move(a));
+    a = Unique<int>(new int(2));
+    Borrowed<int> view = a.borrow();
+}
+
+void moveWhileBorrowed()
+{
+    Unique<int> a(new int(1));
+    Borrowed<int> view = a.borrow();
+    Unique<int> b(std::move(a)); // expected-error {{Cannot move out of 'a' while it is borrowed}}
+}
+
+void moveIntoWhileBorrowed()
+{
+    Unique<int> a(new int(1));
+    BorrowedMut<int> edit = a.borrow_mut();
+    a = Unique<int>(new int(2)); // expected-error {{Cannot move into 'a' while it is borrowed}}
+}
+
+// Only the path that returns moves from a. The lexical engine does not follow
+// control flow, so it reports every later use.
+void movedOnReturningPath(bool flag)
+{
+    Unique<int> a(new int(1));
+    if (flag)
+    {
+        consume(std::move(a));
+        return;
+    }
+    Borrowed<int> view = a.borrow(); // lexical-error {{Use of 'a' after it was moved from}}
+}